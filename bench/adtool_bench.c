@@ -0,0 +1,503 @@
+// ||---------------||
+// ||  ADTOOL BENCH ||
+// ||---------------||
+//
+// Micro benchmarks for the ADTs in library.h. Every result is one row of
+// machine readable output (JSON lines by default, CSV with --csv) so runs from
+// different commits can be diffed or loaded into a spreadsheet.
+//
+//   adtool_bench [--max-size N] [--large] [--csv] [--seed S]
+//
+// Sizes go from 1K up to --max-size (1M by default); --large raises it to 100M,
+// which needs several GB of memory for the hash table rows.
+
+#define _POSIX_C_SOURCE 199309L
+
+#include "../library.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/// Exponent of the Zipfian key distribution (YCSB's default skew)
+#define ZIPF_THETA 0.99
+
+/// Array insert benchmarks are quadratic for head/middle inserts, so they stop here
+#define ARRAY_BENCH_MAX 100000
+
+/// Queue throughput benchmarks pass this many elements through the queue
+#define QUEUE_BENCH_OPS 10000000
+
+/// Lookups each reader thread makes in the concurrent table benchmark
+#define CHT_BENCH_OPS 2000000
+/// Reader counts the concurrent table benchmark runs with
+static const int CHT_READERS[] = { 1, 2, 4, 8 };
+
+static const size_t SIZES[] = { 1000, 10000, 100000, 1000000, 10000000, 100000000 };
+
+/// One line of output. Latency percentiles are 0 for throughput-only benchmarks
+typedef struct {
+    const char *bench;
+    const char *variant;
+    const char *dist;
+    size_t size;
+    size_t ops;
+    double nsPerOp;
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+} BenchResult;
+
+static bool csv = false;
+
+static uint64_t nowNanos(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Prints one result row in the selected format
+ */
+static void report(const BenchResult *r) {
+    if (csv) {
+        printf("%s,%s,%s,%zu,%zu,%.3f,%llu,%llu,%llu,%llu\n", r->bench, r->variant, r->dist, r->size,
+               r->ops, r->nsPerOp, (unsigned long long)r->p50, (unsigned long long)r->p99,
+               (unsigned long long)r->p999, (unsigned long long)r->max);
+    } else {
+        printf("{\"bench\":\"%s\",\"variant\":\"%s\",\"dist\":\"%s\",\"size\":%zu,\"ops\":%zu,"
+               "\"ns_per_op\":%.3f,\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu}\n",
+               r->bench, r->variant, r->dist, r->size, r->ops, r->nsPerOp, (unsigned long long)r->p50,
+               (unsigned long long)r->p99, (unsigned long long)r->p999, (unsigned long long)r->max);
+    }
+    fflush(stdout);
+}
+
+// ||---------------||
+// ||  KEY STREAMS  ||
+// ||---------------||
+
+static uint64_t rngState;
+
+/*
+ * xorshift64*: cheap enough not to show up in the timings
+ */
+static uint64_t nextRandom(void) {
+    rngState ^= rngState >> 12;
+    rngState ^= rngState << 25;
+    rngState ^= rngState >> 27;
+    return rngState * 2685821657736338717ull;
+}
+
+static double nextUnit(void) {
+    return (double)(nextRandom() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/// Zipfian sampler over ranks 1..n by rejection-inversion (Hoermann and
+/// Derflinger), so no per-rank table is needed even at 100M keys
+typedef struct {
+    double n;
+    double hX1;
+    double hN;
+    double s;
+} Zipf;
+
+static double zipfH(double x) {
+    return (pow(x, 1.0 - ZIPF_THETA) - 1.0) / (1.0 - ZIPF_THETA);
+}
+
+static double zipfHInverse(double y) {
+    return pow(y * (1.0 - ZIPF_THETA) + 1.0, 1.0 / (1.0 - ZIPF_THETA));
+}
+
+static double zipfDensity(double x) {
+    return pow(x, -ZIPF_THETA);
+}
+
+static void initZipf(Zipf *z, size_t n) {
+    z->n = (double)n;
+    z->hX1 = zipfH(1.5) - 1.0;
+    z->hN = zipfH(z->n + 0.5);
+    z->s = 2.0 - zipfHInverse(zipfH(2.5) - zipfDensity(2.0));
+}
+
+static size_t nextZipf(const Zipf *z) {
+    for (;;) {
+        double u = z->hN + nextUnit() * (z->hX1 - z->hN);
+        double x = zipfHInverse(u);
+        double k = floor(x + 0.5);
+        if (k < 1.0) {
+            k = 1.0;
+        } else if (k > z->n) {
+            k = z->n;
+        }
+        if (k - x <= z->s || u >= zipfH(k + 0.5) - zipfDensity(k)) {
+            return (size_t)k;
+        }
+    }
+}
+
+/*
+ * Fills keys with n lookups over the key space 1..n, uniform or Zipfian. Zipf
+ * ranks are scattered through the key space so hot keys don't sit together
+ */
+static void fillKeys(size_t *keys, size_t n, bool zipf) {
+    Zipf z;
+    initZipf(&z, n);
+    for (size_t i = 0; i < n; i++) {
+        if (zipf) {
+            keys[i] = (nextZipf(&z) * 0x9E3779B97F4A7C15ull) % n + 1;
+        } else {
+            keys[i] = nextRandom() % n + 1;
+        }
+    }
+}
+
+// ||---------------||
+// ||  HASH TABLE   ||
+// ||---------------||
+
+static size_t hashKey(const void *key) {
+    uint64_t x = (uint64_t)(uintptr_t)key;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    return (size_t)x;
+}
+
+static bool equalKeys(const void *key1, const void *key2) {
+    return key1 == key2;
+}
+
+static int compareNanos(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Sorts samples and stores their percentiles in r
+ */
+static void percentiles(BenchResult *r, uint64_t *samples, size_t n) {
+    if (n == 0) {
+        return;
+    }
+    qsort(samples, n, sizeof(uint64_t), compareNanos);
+    r->p50 = samples[n / 2];
+    r->p99 = samples[(size_t)(n * 0.99)];
+    r->p999 = samples[(size_t)(n * 0.999)];
+    r->max = samples[n - 1];
+}
+
+/*
+ * ht_put of n sequential keys, then per distribution n ht_put into a fresh
+ * table (repeats overwrite, so zipf is mostly updates) and n ht_get hits
+ */
+static void benchHashTable(size_t n, HashProbe probe, const char *variant) {
+    size_t *keys = (size_t *)malloc(n * sizeof(size_t));
+    if (keys == NULL) {
+        fprintf(stderr, "Not enough memory for %zu keys, skipping\n", n);
+        return;
+    }
+    HashADT t = ht_create_probe(probe, hashKey, equalKeys, NULL, NULL);
+    uint64_t start = nowNanos();
+    for (size_t i = 1; i <= n; i++) {
+        ht_put(t, (void *)(uintptr_t)i, (void *)(uintptr_t)i);
+    }
+    BenchResult put = { "ht_put", variant, "sequential", n, n, (double)(nowNanos() - start) / n, 0, 0, 0, 0 };
+    report(&put);
+
+    const char *dists[2] = { "uniform", "zipf" };
+    for (int d = 0; d < 2; d++) {
+        fillKeys(keys, n, d == 1);
+        HashADT fresh = ht_create_probe(probe, hashKey, equalKeys, NULL, NULL);
+        start = nowNanos();
+        for (size_t i = 0; i < n; i++) {
+            ht_put(fresh, (void *)(uintptr_t)keys[i], (void *)(uintptr_t)keys[i]);
+        }
+        BenchResult drawn = { "ht_put", variant, dists[d], n, n, (double)(nowNanos() - start) / n, 0, 0, 0, 0 };
+        report(&drawn);
+        ht_destroy(fresh);
+
+        size_t sink = 0;
+        start = nowNanos();
+        for (size_t i = 0; i < n; i++) {
+            sink += (size_t)(uintptr_t)ht_get(t, (void *)(uintptr_t)keys[i]);
+        }
+        BenchResult get = { "ht_get", variant, dists[d], n, n, (double)(nowNanos() - start) / n, 0, 0, 0, 0 };
+        report(&get);
+        if (sink == 0) {
+            fprintf(stderr, "ht_get found nothing\n");
+        }
+    }
+    ht_destroy(t);
+    free(keys);
+}
+
+/*
+ * Latency of each ht_put while n keys go into a table: 1..n when dist is
+ * "sequential", else drawn by fillKeys. The "resize" rows only sample the puts
+ * that started a rehash; "ht_put_latency" covers all of them, showing how
+ * incremental mode spreads the migration out
+ */
+static void benchResize(size_t n, bool incremental, const char *dist) {
+    const char *variant = incremental ? "incremental" : "stop_the_world";
+    uint64_t *all = (uint64_t *)malloc(n * sizeof(uint64_t));
+    uint64_t *rehash = (uint64_t *)malloc(64 * sizeof(uint64_t));
+    size_t *keys = (size_t *)malloc(n * sizeof(size_t));
+    if (all == NULL || rehash == NULL || keys == NULL) {
+        fprintf(stderr, "Not enough memory for %zu samples, skipping\n", n);
+        free(all);
+        free(rehash);
+        free(keys);
+        return;
+    }
+    if (strcmp(dist, "sequential") == 0) {
+        for (size_t i = 0; i < n; i++) {
+            keys[i] = i + 1;
+        }
+    } else {
+        fillKeys(keys, n, strcmp(dist, "zipf") == 0);
+    }
+    HashADT t = ht_create(hashKey, equalKeys, NULL, NULL);
+    ht_set_incremental(t, incremental);
+    HashStats stats;
+    size_t rehashes = 0;
+    size_t resizes = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t start = nowNanos();
+        ht_put(t, (void *)(uintptr_t)keys[i], (void *)(uintptr_t)keys[i]);
+        all[i] = nowNanos() - start;
+        ht_stats(t, &stats);
+        if (stats.rehashes != rehashes && resizes < 64) {
+            rehash[resizes++] = all[i];
+        }
+        rehashes = stats.rehashes;
+    }
+    BenchResult r = { "resize", variant, dist, n, resizes,
+                      resizes != 0 ? (double)stats.resizeNanos / resizes : 0.0, 0, 0, 0, 0 };
+    percentiles(&r, rehash, resizes);
+    report(&r);
+    BenchResult p = { "ht_put_latency", variant, dist, n, n, 0.0, 0, 0, 0, 0 };
+    uint64_t total = 0;
+    for (size_t i = 0; i < n; i++) {
+        total += all[i];
+    }
+    p.nsPerOp = (double)total / n;
+    percentiles(&p, all, n);
+    report(&p);
+    ht_destroy(t);
+    free(all);
+    free(rehash);
+    free(keys);
+}
+
+// ||-----------------------||
+// || CONCURRENT HASH TABLE ||
+// ||-----------------------||
+
+typedef struct {
+    ConcurrentHashADT table;
+    const size_t *keys;
+    size_t sink;
+} ChtReaderTask;
+
+static void *chtReadLoop(void *arg) {
+    ChtReaderTask *task = (ChtReaderTask *)arg;
+    size_t sink = 0;
+    for (size_t i = 0; i < CHT_BENCH_OPS; i++) {
+        sink += (size_t)(uintptr_t)cht_get(task->table, (void *)(uintptr_t)task->keys[i]);
+    }
+    task->sink = sink;
+    return NULL;
+}
+
+/*
+ * Aggregate cht_get throughput of readers threads sharing an n entry table,
+ * each doing CHT_BENCH_OPS uniform lookups. ns_per_op is wall time over all
+ * lookups, so it falls as readers are added while reads scale
+ */
+static void benchConcurrentGet(size_t n, int readers) {
+    size_t *keys = (size_t *)malloc((size_t)readers * CHT_BENCH_OPS * sizeof(size_t));
+    if (keys == NULL) {
+        fprintf(stderr, "Not enough memory for %d readers, skipping\n", readers);
+        return;
+    }
+    ConcurrentHashADT t = cht_create(hashKey, equalKeys, NULL, NULL);
+    for (size_t i = 1; i <= n; i++) {
+        cht_put(t, (void *)(uintptr_t)i, (void *)(uintptr_t)i);
+    }
+    for (size_t i = 0; i < (size_t)readers * CHT_BENCH_OPS; i++) {
+        keys[i] = nextRandom() % n + 1;
+    }
+    pthread_t threads[8];
+    ChtReaderTask tasks[8];
+    uint64_t start = nowNanos();
+    for (int r = 0; r < readers; r++) {
+        tasks[r] = (ChtReaderTask){ t, keys + (size_t)r * CHT_BENCH_OPS, 0 };
+        pthread_create(&threads[r], NULL, chtReadLoop, &tasks[r]);
+    }
+    for (int r = 0; r < readers; r++) {
+        pthread_join(threads[r], NULL);
+    }
+    size_t ops = (size_t)readers * CHT_BENCH_OPS;
+    char variant[32];
+    snprintf(variant, sizeof(variant), "readers_%d", readers);
+    BenchResult result = { "cht_get", variant, "uniform", n, ops, (double)(nowNanos() - start) / ops, 0, 0, 0, 0 };
+    report(&result);
+    cht_destroy(t);
+    free(keys);
+}
+
+// ||---------------||
+// ||     ARRAY     ||
+// ||---------------||
+
+/*
+ * Builds an n element array through insertArrayElement at the head, middle or tail
+ */
+static void benchArrayInsert(size_t n, int where) {
+    const char *variants[3] = { "head", "middle", "tail" };
+    Array arr;
+    initArray(&arr, 16);
+    uint64_t start = nowNanos();
+    for (size_t i = 0; i < n; i++) {
+        size_t index = where == 0 ? 0 : where == 1 ? arr.size / 2 : arr.size;
+        insertArrayElement(&arr, (void *)(uintptr_t)i, index);
+    }
+    BenchResult r = { "insertArrayElement", variants[where], "sequential", n, n,
+                      (double)(nowNanos() - start) / n, 0, 0, 0, 0 };
+    report(&r);
+    freeArray(&arr);
+}
+
+// ||---------------||
+// ||     QUEUE     ||
+// ||---------------||
+
+/*
+ * Throughput of enqueue/dequeue pairs through a queue kept depth elements deep
+ */
+static void benchQueue(size_t depth, const char *variant) {
+    Queue queue;
+    NodePool pool;
+    initNodePool(&pool, 0);
+    if (strcmp(variant, "ring") == 0) {
+        initRingQueue(&queue, depth);
+    } else {
+        initQueue(&queue, depth);
+        if (strcmp(variant, "pooled") == 0) {
+            bindQueuePool(&queue, &pool);
+        }
+    }
+    for (size_t i = 0; i < depth - 1; i++) {
+        enqueue(&queue, NULL);
+    }
+    uint64_t start = nowNanos();
+    for (size_t i = 0; i < QUEUE_BENCH_OPS; i++) {
+        enqueue(&queue, (void *)(uintptr_t)i);
+        dequeue(&queue);
+    }
+    BenchResult r = { "enqueue_dequeue", variant, "fifo", depth, QUEUE_BENCH_OPS,
+                      (double)(nowNanos() - start) / QUEUE_BENCH_OPS, 0, 0, 0, 0 };
+    report(&r);
+    // freeQueue frees what is left, and these elements aren't heap pointers
+    while (!isQueueEmpty(&queue)) {
+        dequeue(&queue);
+    }
+    freeQueue(&queue);
+    freeNodePool(&pool);
+}
+
+// ||----------------||
+// || PRIORITY QUEUE ||
+// ||----------------||
+
+/*
+ * Orders deadlines stored directly in the item pointer
+ */
+static int compareDeadlines(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t)a, y = (uintptr_t)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Timer queue n deadlines deep: heapify once, then pop the earliest deadline
+ * and reschedule it a random distance into the future
+ */
+static void benchPriorityQueue(size_t n) {
+    Array deadlines;
+    initArray(&deadlines, n);
+    for (size_t i = 0; i < n; i++) {
+        insertArrayElement(&deadlines, (void *)(uintptr_t)(nextRandom() % n + 1), i);
+    }
+    PriorityQueue pq;
+    uint64_t start = nowNanos();
+    initPriorityQueueFromArray(&pq, &deadlines, compareDeadlines);
+    BenchResult heapify = { "pq_heapify", "4ary", "uniform", n, n, (double)(nowNanos() - start) / n, 0, 0, 0, 0 };
+    report(&heapify);
+    start = nowNanos();
+    for (size_t i = 0; i < n; i++) {
+        uintptr_t due = (uintptr_t)pqPop(&pq);
+        pqPush(&pq, (void *)(due + nextRandom() % n + 1));
+    }
+    BenchResult churn = { "pq_pop_push", "4ary", "uniform", n, n, (double)(nowNanos() - start) / n, 0, 0, 0, 0 };
+    report(&churn);
+    freePriorityQueue(&pq);
+    freeArray(&deadlines);
+}
+
+int main(int argc, char **argv) {
+    size_t maxSize = 1000000;
+    rngState = 0x2545F4914F6CDD1Dull;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--csv") == 0) {
+            csv = true;
+        } else if (strcmp(argv[i], "--large") == 0) {
+            maxSize = 100000000;
+        } else if (strcmp(argv[i], "--max-size") == 0 && i + 1 < argc) {
+            maxSize = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            rngState = strtoull(argv[++i], NULL, 10) | 1;
+        } else {
+            fprintf(stderr, "usage: %s [--max-size N] [--large] [--csv] [--seed S]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (csv) {
+        printf("bench,variant,dist,size,ops,ns_per_op,p50_ns,p99_ns,p999_ns,max_ns\n");
+    }
+
+    size_t sizes = sizeof(SIZES) / sizeof(SIZES[0]);
+    size_t largest = SIZES[0];
+    for (size_t s = 0; s < sizes && SIZES[s] <= maxSize; s++) {
+        benchHashTable(SIZES[s], HT_PROBE_LINEAR, "linear");
+        benchHashTable(SIZES[s], HT_PROBE_SWISS, "swiss");
+        benchHashTable(SIZES[s], HT_PROBE_ROBINHOOD, "robinhood");
+        largest = SIZES[s];
+    }
+    const char *resizeDists[3] = { "sequential", "uniform", "zipf" };
+    for (int d = 0; d < 3; d++) {
+        benchResize(largest, false, resizeDists[d]);
+        benchResize(largest, true, resizeDists[d]);
+    }
+    for (size_t r = 0; r < sizeof(CHT_READERS) / sizeof(CHT_READERS[0]); r++) {
+        benchConcurrentGet(largest, CHT_READERS[r]);
+    }
+    for (size_t s = 0; s < sizes && SIZES[s] <= maxSize && SIZES[s] <= ARRAY_BENCH_MAX; s++) {
+        for (int where = 0; where < 3; where++) {
+            benchArrayInsert(SIZES[s], where);
+        }
+    }
+    const char *queues[3] = { "linked", "pooled", "ring" };
+    for (int q = 0; q < 3; q++) {
+        benchQueue(1024, queues[q]);
+    }
+    for (size_t s = 0; s < sizes && SIZES[s] <= maxSize; s++) {
+        benchPriorityQueue(SIZES[s]);
+    }
+    return EXIT_SUCCESS;
+}
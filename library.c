@@ -1,6 +1,72 @@
 #include "library.h"
 
 #include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define ADTOOL_HAVE_MMAP 1
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/// Sentinel index returned by the hash table's probe helpers on a miss
+#define HT_NOT_FOUND ((size_t)-1)
+
+/*
+ * Monotonic clock reading used to time expensive operations
+ */
+static uint64_t nowNanos(void) {
+    struct timespec ts;
+#if defined(CLOCK_MONOTONIC)
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+#if defined(__GNUC__)
+#define HT_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define HT_PREFETCH(addr) ((void)(addr))
+#endif
+
+#ifdef ADTOOL_INSTRUMENT
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define ADTOOL_HAVE_RDTSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define ADTOOL_HAVE_RDTSC 1
+#endif
+
+/// Bumps one of a structure's counters
+#define ADT_COUNT(counter) ((counter)++)
+#define ADT_ADD(counter, n) ((counter) += (n))
+/// Cheap tick reading for timing hot paths
+#define ADT_CYCLES() readCycles()
+#define ADT_TRACE(event, source, oldCapacity, newCapacity, cycles) \
+    adtTrace(event, source, oldCapacity, newCapacity, cycles)
+#else
+/// Without ADTOOL_INSTRUMENT all of these compile to nothing. Arguments other
+/// than counters are still evaluated (so no local goes unused) and are always
+/// side effect free, which lets the optimiser drop them entirely
+#define ADT_COUNT(counter) ((void)0)
+#define ADT_ADD(counter, n) ((void)(n))
+#define ADT_CYCLES() ((uint64_t)0)
+#define ADT_TRACE(event, source, oldCapacity, newCapacity, cycles) \
+    ((void)(source), (void)(oldCapacity), (void)(newCapacity), (void)(cycles))
+#endif
 
 // ||---------------||
 // ||    Helpers    ||
@@ -11,508 +77,4661 @@
  */
 Node *newNode(void *data) {
     Node *new = (Node *)malloc(sizeof(Node));
+    if (new == NULL) {
+        fprintf(stderr, "Memory allocation failed creating new node.\n");
+        exit(EXIT_FAILURE);
+    }
     new->data = data;
     new->next = NULL;
+    return new;
 }
 
-// ||---------------||
-// || DYNAMIC ARRAY ||
-// ||---------------||
+/// Block of nodes handed out by a NodePool
+struct NodeChunk {
+    struct NodeChunk *next;
+    Node nodes[];
+};
 
 /*
- * Initialize dynamic array
+ * Initializes a node pool that allocates chunkSize nodes at a time
+ * (NODE_POOL_CHUNK when 0)
  */
-void initArray(Array *arr, size_t init_capacity) {
-    arr->array = (void **)malloc(init_capacity * sizeof(void *));
-    arr->size = 0;
-    arr->capacity = init_capacity;
+void initNodePool(NodePool *pool, size_t chunkSize) {
+    pool->free = NULL;
+    pool->chunks = NULL;
+    pool->chunkSize = chunkSize != 0 ? chunkSize : NODE_POOL_CHUNK;
 }
 
 /*
- * Function lets you add an element to the array at any index.
+ * Takes a node from the pool, allocating a new chunk when it has run dry
  */
-void insertArrayElement(Array *arr, void *element, size_t index) {
-    // index not in bounds of array
-    if (index > arr->size) {
-        fprintf(stderr, "Index (%zu) out of bounds for array size (%zu)", index, arr->size);
-        exit(EXIT_FAILURE);
-    }
-    // check if array needs resizing
-    if (arr->size == arr->capacity) {
-        arr->capacity *= 2; // double cap
-        arr->array = (void **) realloc(arr->array, arr->capacity * sizeof(void *));
-        // if realloc fails exit with error message
-        if (arr->array == NULL) {
-            fprintf(stderr, "Reallocation error adding element (%p) to dynamic array.", element);
+Node *poolNode(NodePool *pool, void *data) {
+    if (pool->free == NULL) {
+        struct NodeChunk *chunk = (struct NodeChunk *)malloc(sizeof(struct NodeChunk)
+                                                             + pool->chunkSize * sizeof(Node));
+        if (chunk == NULL) {
+            fprintf(stderr, "Memory allocation failed creating node pool chunk.\n");
             exit(EXIT_FAILURE);
         }
+        chunk->next = pool->chunks;
+        pool->chunks = chunk;
+        // thread the fresh nodes onto the free list
+        for (size_t i = 0; i < pool->chunkSize; i++) {
+            chunk->nodes[i].next = i + 1 < pool->chunkSize ? &chunk->nodes[i + 1] : NULL;
+        }
+        pool->free = chunk->nodes;
     }
-
-    // shift elements to the right
-    for (size_t i = arr->size; i > index; i--) {
-        arr->array[i] = arr->array[i-1];
-    }
-
-    arr->array[arr->size] = element; // add element to end of array
-    arr->size++; // increase size
+    Node *node = pool->free;
+    pool->free = node->next;
+    node->data = data;
+    node->next = NULL;
+    return node;
 }
 
 /*
- * Gets element at index
+ * Gives the chain of nodes first..last (linked through next) back to the pool at once
  */
-void *getArrayElement(Array *arr, size_t index) {
-    if (index < arr->size) {
-        return arr->array[index];
-    }
+void releaseNodes(NodePool *pool, Node *first, Node *last) {
+    last->next = pool->free;
+    pool->free = first;
 }
 
 /*
- * Free up space after usage.
+ * Frees every chunk of the pool. Nodes still in use by a list or queue become invalid
  */
-void freeArray(Array *arr) {
-    free(arr->array);
-    arr->size = 0;
-    arr->capacity = 0;
+void freeNodePool(NodePool *pool) {
+    while (pool->chunks != NULL) {
+        struct NodeChunk *next = pool->chunks->next;
+        free(pool->chunks);
+        pool->chunks = next;
+    }
+    pool->free = NULL;
 }
 
-// ||---------------||
-// ||   HASH TABLE  ||
-// ||---------------||
+static void *mallocAllocate(void *ctx, size_t size) {
+    (void)ctx;
+    return malloc(size);
+}
 
-struct hashtab_s {
-    size_t capacity;
-    size_t size;
-    size_t rehashes;
-    Bucket *table;
-    size_t (*hash)(const void *key);
-    // these three are user defined!!
-    bool (*equals)(const void *key1, const void *key2);
-    void (*print)(const void *key, const void *value);
-    void (*delete)(void *key, void *value);
-};
+static void *mallocReallocate(void *ctx, void *ptr, size_t oldSize, size_t newSize) {
+    (void)ctx;
+    (void)oldSize;
+    return realloc(ptr, newSize);
+}
+
+static void mallocRelease(void *ctx, void *ptr, size_t size) {
+    (void)ctx;
+    (void)size;
+    free(ptr);
+}
+
+const Allocator defaultAllocator = { mallocAllocate, mallocReallocate, mallocRelease, NULL };
 
 /*
- * Calculates load factor for the hash table based on current size and capacity
+ * Resolves the NULL allocator to malloc
  */
-static double loadFactor(HashADT t) {
-    return (double)t->size / t->capacity;
+static inline const Allocator *allocatorOf(const Allocator *allocator) {
+    return allocator != NULL ? allocator : &defaultAllocator;
+}
+
+static inline void *allocWith(const Allocator *allocator, size_t size) {
+    allocator = allocatorOf(allocator);
+    return allocator->allocate(allocator->ctx, size);
+}
+
+static inline void *reallocWith(const Allocator *allocator, void *ptr, size_t oldSize, size_t newSize) {
+    allocator = allocatorOf(allocator);
+    if (ptr == NULL) {
+        return allocator->allocate(allocator->ctx, newSize);
+    }
+    return allocator->reallocate(allocator->ctx, ptr, oldSize, newSize);
 }
 
 /*
- * Function to resize the hashtable when needed
+ * Zero-filled allocation. malloc's calloc can hand back fresh pages without
+ * touching them, so only other allocators pay for the memset
  */
-static void resize(HashADT t) {
-    size_t newCapacity = t->capacity * RESIZE_FACTOR;
-    t->rehashes++;
-    Bucket *new_table = (Bucket *)calloc(newCapacity, sizeof(Bucket));
-    if (new_table == NULL) {
-        fprintf(stderr, "Memory allocation failed during resizing\n");
-        exit(1);
+static inline void *allocZeroedWith(const Allocator *allocator, size_t size) {
+    if (allocatorOf(allocator) == &defaultAllocator) {
+        return calloc(1, size);
     }
-
-    for (size_t i = 0; i < t->capacity; i++) {
-        if (t->table[i].isOccupied) {
-            KeyValue *pair = t->table[i].pair;
-            size_t index = t->hash(pair->key) % newCapacity;
-            while (new_table[index].isOccupied) {
-                index = (index + 1) % newCapacity;
-            }
-            new_table[index].pair = pair;
-            new_table[index].isOccupied = true;
-        }
+    void *ptr = allocWith(allocator, size);
+    if (ptr != NULL) {
+        memset(ptr, 0, size);
     }
+    return ptr;
+}
 
-    free(t->table);
-    t->table = new_table;
-    t->capacity = newCapacity;
+static inline void releaseWith(const Allocator *allocator, void *ptr, size_t size) {
+    if (ptr != NULL) {
+        allocator = allocatorOf(allocator);
+        allocator->release(allocator->ctx, ptr, size);
+    }
 }
 
+/// Block of memory an Arena bumps through
+struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t size; // usable bytes in data
+    size_t used;
+    size_t last; // offset of the most recent allocation, for in-place regrowth
+    max_align_t data[];
+};
+
+/// Every arena allocation is aligned for any type
+#define ARENA_ALIGN (_Alignof(max_align_t))
+_Static_assert((ARENA_ALIGN & (ARENA_ALIGN - 1)) == 0, "arena alignment must be a power of two");
+
 /*
- * Creates key-value pair
+ * Rounds size up to ARENA_ALIGN so the next allocation stays aligned too
  */
-static KeyValue *createPair(const void *key, const void *value) {
-    KeyValue *pair = (KeyValue *)malloc(sizeof(KeyValue));
-    if (pair == NULL) {
-        fprintf(stderr, "Memory allocation failed during key-value pair creation");
-        exit(1);
-    }
-    pair->key = key;
-    pair->value = value;
-    return pair;
+static inline size_t arenaRound(size_t size) {
+    return (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
 }
 
+static void *arenaAllocate(void *ctx, size_t size) {
+    return arenaAlloc((Arena *)ctx, size);
+}
 
 /*
- * Creates a new HashADT instance
+ * Growing the most recent allocation happens in place when its block has room;
+ * anything else is copied to a fresh allocation and the old bytes stay put
  */
-HashADT ht_create(size_t (*hash)( const void *key),
-                  bool (*equals)(const void *key1, const void *key2),
-                  void (*print) ( const void *key, const void *value),
-                  void (*delete)(void *key, void *value)) {
-    HashADT t = (HashADT)malloc(sizeof(struct hashtab_s));
-    if (t == NULL) {
-        fprintf(stderr, "Memory allocation failed creating the hashtable");
-        exit(1);
+static void *arenaReallocate(void *ctx, void *ptr, size_t oldSize, size_t newSize) {
+    Arena *arena = (Arena *)ctx;
+    struct ArenaBlock *block = arena->blocks;
+    size_t rounded = arenaRound(newSize);
+    if (block != NULL && (char *)ptr == (char *)block->data + block->last
+        && rounded <= block->size - block->last) {
+        block->used = block->last + rounded;
+        return ptr;
     }
-    t->capacity = INITIAL_CAPACITY;
-    t->size = 0;
-    t->table = (Bucket *)calloc(t->capacity, sizeof(Bucket));
-    if (t->table == NULL) {
-        fprintf(stderr, "Memory allocation failed creating table's buckets");
-        exit(1);
+    void *moved = arenaAlloc(arena, newSize);
+    if (moved != NULL) {
+        memcpy(moved, ptr, oldSize < newSize ? oldSize : newSize);
     }
-    t->hash = hash;
-    t->equals = equals;
-    t->print = print;
-    t->delete = delete;
-    return t;
+    return moved;
 }
 
 /*
- * Destroys specified HashADT, deallocating any dynamic storage
+ * Only the most recent allocation is handed back, so stack-like use reclaims space
  */
-void ht_destroy( HashADT t) {
-    if (t == NULL) {
-        fprintf(stderr, "Invalid table to destroy\n");
-        exit(1);
+static void arenaRelease(void *ctx, void *ptr, size_t size) {
+    (void)size;
+    struct ArenaBlock *block = ((Arena *)ctx)->blocks;
+    if (block != NULL && (char *)ptr == (char *)block->data + block->last) {
+        block->used = block->last;
     }
-    for (size_t i = 0; i < t->capacity; i++) {
-        if (t->table[i].isOccupied) {
-            KeyValue *pair = t->table[i].pair;
-            if (t->delete != NULL) {
-                t->delete((void *)pair->key, (void *)pair->value);
-            }
-            free(pair);
-        }
-    }
-    free(t->table);
-    free(t);
 }
 
 /*
- * Prints all required information about the hashtable
+ * Initializes an empty arena that takes blockSize bytes at a time
+ * (ARENA_BLOCK_SIZE when 0) from parent (malloc when NULL)
  */
-void ht_dump(const HashADT t, bool contents) {
-    if (t == NULL) {
-        fprintf(stderr, "Invalid table to dump\n");
-        exit(1);
-    }
-    printf("Size: %zu\n", t->size);
-    printf("Capacity: %zu\n", t->capacity);
+void initArena(Arena *arena, size_t blockSize, const Allocator *parent) {
+    arena->allocator.allocate = arenaAllocate;
+    arena->allocator.reallocate = arenaReallocate;
+    arena->allocator.release = arenaRelease;
+    arena->allocator.ctx = arena;
+    arena->blocks = NULL;
+    arena->blockSize = blockSize != 0 ? blockSize : ARENA_BLOCK_SIZE;
+    arena->parent = parent;
+}
 
-    int collisions = 0;
-    if (contents) {
-        for (size_t i = 0; i < t->capacity; i++) {
-            if (t->table[i].isOccupied) {
-                KeyValue *pair = t->table[i].pair;
-                if (pair != NULL) {
-                    if (i != t->hash(pair->key) % t->capacity) {
-                        collisions++;
-                    }
-                }
-            }
-        }
-        printf("Collisions: %d\n", collisions);
-        printf("Rehashes: %zu\n", t->rehashes);
-        for (size_t i = 0; i < t->capacity; i++) {
-            if (t->table[i].isOccupied) {
-                KeyValue *pair = t->table[i].pair;
-                if (pair != NULL && pair->key != NULL && pair->value != NULL) {
-                    printf("%zu : ( ", i);
-                    t->print(pair->key, pair->value);
-                    printf(" )\n");
-                }
-            } else {
-                printf("%zu : null\n", i);
-            }
+/*
+ * Bumps out size bytes from the newest block, starting a new block when it
+ * is full. Requests bigger than a block get a block of their own
+ */
+void *arenaAlloc(Arena *arena, size_t size) {
+    size_t rounded = arenaRound(size);
+    struct ArenaBlock *block = arena->blocks;
+    if (block == NULL || block->size - block->used < rounded) {
+        size_t blockBytes = rounded > arena->blockSize ? rounded : arena->blockSize;
+        block = (struct ArenaBlock *)allocWith(arena->parent, sizeof(struct ArenaBlock) + blockBytes);
+        if (block == NULL) {
+            return NULL;
         }
+        block->size = blockBytes;
+        block->used = 0;
+        block->next = arena->blocks;
+        arena->blocks = block;
     }
+    block->last = block->used;
+    block->used += rounded;
+    return (char *)block->data + block->last;
 }
 
 /*
- * Gets value with specified key
+ * Forgets every allocation but keeps the newest block for reuse
  */
-const void *ht_get(const HashADT t, const void *key) {
-    size_t index = t->hash(key) % t->capacity;
-    while (t->table[index].isOccupied) {
-        if (t->equals(key, t->table[index].pair->key)) {
-            return t->table[index].pair->value;
-        }
-        index = (index + 1) % t->capacity;
+void arenaReset(Arena *arena) {
+    struct ArenaBlock *keep = arena->blocks;
+    if (keep == NULL) {
+        return;
     }
-    return NULL;
+    struct ArenaBlock *block = keep->next;
+    while (block != NULL) {
+        struct ArenaBlock *next = block->next;
+        releaseWith(arena->parent, block, sizeof(struct ArenaBlock) + block->size);
+        block = next;
+    }
+    keep->next = NULL;
+    keep->used = 0;
+    keep->last = 0;
 }
 
 /*
- * returns a boolean depending on if a key has a value or not
+ * Returns every block to the parent allocator. Everything built on the arena
+ * becomes invalid, so there is no need to tear those structures down first
  */
-bool ht_has(const HashADT t, const void *key) {
-    return ht_get(t, key) != NULL;
+void freeArena(Arena *arena) {
+    arenaReset(arena);
+    if (arena->blocks != NULL) {
+        releaseWith(arena->parent, arena->blocks, sizeof(struct ArenaBlock) + arena->blocks->size);
+        arena->blocks = NULL;
+    }
 }
 
 /*
- * Puts a value at a key in the hashtable
+ * Node for a list or queue: from its pool if bound to one, else from its allocator
  */
-void *ht_put(HashADT t, const void *key, const void *value) {
-    if (t == NULL || key == NULL) {
-        fprintf(stderr, "Invalid table or key\n");
-        exit(1);
+static Node *allocNode(NodePool *pool, const Allocator *allocator, void *data) {
+    if (pool != NULL) {
+        return poolNode(pool, data);
     }
-    if (loadFactor(t) >= LOAD_THRESHOLD) {
-        resize(t);
+    if (allocator == NULL) {
+        return newNode(data);
     }
-
-    size_t index = t->hash(key) % t->capacity;
-    while (t->table[index].isOccupied) {
-        if (t->equals(key, t->table[index].pair->key)) {
-            void *old = (void *)t->table[index].pair->value;
-            t->table[index].pair->value = value;
-            return old;
-        }
-        index = (index + 1) % t->capacity;
-    }
-    KeyValue *pair = createPair(key, value);
-
-    // get empty slot
-    while (t->table[index].isOccupied) {
-        index = (index + 1) % t->capacity;
+    Node *new = (Node *)allocWith(allocator, sizeof(Node));
+    if (new == NULL) {
+        fprintf(stderr, "Memory allocation failed creating new node.\n");
+        exit(EXIT_FAILURE);
     }
-    // put pair in table
-    t->table[index].pair = pair;
-    t->table[index].isOccupied = true;
-    t->size++; // Increment the size here
-
-    // no old value for key
-    return NULL;
+    new->data = data;
+    new->next = NULL;
+    return new;
 }
 
 /*
- * Returns array of all the keys
+ * Returns a single node to where allocNode got it from
  */
-void **ht_keys(const HashADT t) {
-    if (t == NULL) {
-        fprintf(stderr, "Invalid table to obtain keys\n");
+static void releaseNode(NodePool *pool, const Allocator *allocator, Node *node) {
+    if (pool != NULL) {
+        releaseNodes(pool, node, node);
+    } else {
+        releaseWith(allocator, node, sizeof(Node));
     }
+}
 
-    void **keys = (void **)malloc(t->size * sizeof(void *));
-    if (keys == NULL) {
-        fprintf(stderr, "Memory allocation failed while creating keys\n");
-        exit(1);
-    }
+// ||-----------------||
+// || INSTRUMENTATION ||
+// ||-----------------||
 
-    size_t keysIndex = 0;
-    for (size_t i = 0; i < t->capacity; i++) {
-        if (t->table[i].isOccupied) {
-            keys[keysIndex] = (void *)t->table[i].pair->key;
-            keysIndex++;
-        }
-    }
+#ifdef ADTOOL_INSTRUMENT
+static AdtTraceHook traceHook = NULL;
+static void *traceCtx = NULL;
 
-    return keys;
+/*
+ * Time stamp counter where the CPU has one (rdtsc, or the virtual counter on
+ * arm64), the monotonic clock in nanoseconds elsewhere
+ */
+static inline uint64_t readCycles(void) {
+#if defined(ADTOOL_HAVE_RDTSC)
+    return (uint64_t)__rdtsc();
+#elif defined(__aarch64__) && defined(__GNUC__)
+    uint64_t ticks;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    return nowNanos();
+#endif
 }
 
 /*
- * Returns collection of values as array of pointers, allocates space which the caller is responsible
- * to deallocate
+ * Hands an event to the installed hook, if there is one
  */
-void **ht_values(const HashADT t) {
-    if (t == NULL) {
-        fprintf(stderr, "Invalid table to return values\n");
-        exit(1);
-    }
-
-    void **values = (void **)malloc(t->size * sizeof(void *));
-    if (values == NULL) {
-        fprintf(stderr, "Memory allocation error creating values\n");
-        exit(1);
+static void adtTrace(AdtTraceEvent event, const void *source, size_t oldCapacity, size_t newCapacity,
+                     uint64_t cycles) {
+    if (traceHook != NULL) {
+        AdtTrace trace = { event, source, oldCapacity, newCapacity, cycles };
+        traceHook(&trace, traceCtx);
     }
+}
+#endif
 
-    size_t valuesIndex = 0;
-    for (size_t i = 0; i < t->capacity; i++) {
-        if (t->table[i].isOccupied) {
-            values[valuesIndex] = (void *)t->table[i].pair->value;
-            valuesIndex++;
-        }
-    }
-    return values;
+/*
+ * Installs hook (NULL removes it) for every structure. Set it before the
+ * structures are shared between threads. A no-op without ADTOOL_INSTRUMENT
+ */
+void adtSetTraceHook(AdtTraceHook hook, void *ctx) {
+#ifdef ADTOOL_INSTRUMENT
+    traceHook = hook;
+    traceCtx = ctx;
+#else
+    (void)hook;
+    (void)ctx;
+#endif
 }
 
 // ||---------------||
-// ||  Linked List  ||
+// || DYNAMIC ARRAY ||
 // ||---------------||
 
 /*
- * Initializes linked list
+ * Initialize dynamic array
  */
-void initLinkedList(LinkedList *list) {
-    list->head = NULL;
-    list->size = 0;
+void initArray(Array *arr, size_t init_capacity) {
+    initArrayAlloc(arr, init_capacity, NULL);
 }
 
 /*
- * Inserts a node in the linked list
+ * Initialize dynamic array whose storage comes from allocator
  */
-void insert(LinkedList *list, void *data) {
-    Node *new = (Node *)malloc(sizeof(Node));
-    if (new == NULL) {
-        fprintf(stderr, "Memory allocation failed creating new linked list node.\n");
+void initArrayAlloc(Array *arr, size_t init_capacity, const Allocator *allocator) {
+    arr->allocator = allocator;
+    arr->array = init_capacity != 0 ? (void **)allocWith(allocator, init_capacity * sizeof(void *)) : NULL;
+    if (init_capacity != 0 && arr->array == NULL) {
+        fprintf(stderr, "Memory allocation failed creating dynamic array of (%zu) elements.", init_capacity);
         exit(EXIT_FAILURE);
     }
-    new->data = data;
-    new->next = list->head;
-    list->head = new;
-    list->size++;
+    arr->size = 0;
+    arr->capacity = init_capacity;
+#ifdef ADTOOL_INSTRUMENT
+    arr->counters = (ArrayCounters){ 0 };
+#endif
 }
 
 /*
- * Checks if the list is empty
+ * Books a reallocation of the backing store that started at cycle start
  */
-bool isLinkedListEmpty(LinkedList *list) {
-    return (list->size == 0);
+static inline void arrayReallocated(Array *arr, size_t oldCapacity, uint64_t start) {
+    uint64_t cycles = ADT_CYCLES() - start;
+    ADT_COUNT(arr->counters.reallocs);
+    ADT_ADD(arr->counters.reallocCycles, cycles);
+    ADT_TRACE(ADT_TRACE_ARRAY_REALLOC, arr, oldCapacity, arr->capacity, cycles);
 }
 
 /*
- * Removes the first node in the list
+ * Grows the backing store to hold at least needed elements, at least doubling
+ * the capacity so repeated growth stays amortised O(1)
  */
-void removeFirstLinkedNode(LinkedList *list) {
-    if (isLinkedListEmpty(list)) {
-        fprintf(stderr, "List is empty. Cannot remove first node.\n");
+static void arrayGrow(Array *arr, size_t needed) {
+    if (needed <= arr->capacity) {
         return;
     }
-    Node *node = list->head;
-    list->head = node->next;
-    free(node);
-    list->size--;
+    size_t capacity = arr->capacity * 2;
+    if (capacity < needed) {
+        capacity = needed;
+    }
+    size_t oldCapacity = arr->capacity;
+    uint64_t start = ADT_CYCLES();
+    void **array = (void **) reallocWith(arr->allocator, arr->array, arr->capacity * sizeof(void *),
+                                         capacity * sizeof(void *));
+    // if realloc fails exit with error message
+    if (array == NULL) {
+        fprintf(stderr, "Reallocation error growing dynamic array to (%zu) elements.", capacity);
+        exit(EXIT_FAILURE);
+    }
+    arr->array = array;
+    arr->capacity = capacity;
+    arrayReallocated(arr, oldCapacity, start);
 }
 
 /*
- * Removes a specific node in the linked list
+ * Function lets you add an element to the array at any index.
  */
-void removeLinkedListNode(LinkedList *list, void *data) {
-    if (isLinkedListEmpty(list)) {
-        fprintf(stderr, "List is empty. Cannot remove specified node.\n");
-        return;
-    }
-    Node *curr = list->head;
-    Node *prev = NULL;
-    // loops until data is found or end of linked list reached
-    while (curr != NULL) {
-        if (curr->data == data) {
-                if (prev == NULL) {
-                    list->head = curr->next;
-                } else {
-                    prev->next = curr->next;
-                }
-                free(curr);
-                list->size--;
-                return;
-        }
-        prev = curr;
-        curr = curr->next;
+void insertArrayElement(Array *arr, void *element, size_t index) {
+    // index not in bounds of array
+    if (index > arr->size) {
+        fprintf(stderr, "Index (%zu) out of bounds for array size (%zu)", index, arr->size);
+        exit(EXIT_FAILURE);
     }
-    // no data found
-    fprintf(stderr, "Data does not exist in linked list.\n");
+    // check if array needs resizing
+    arrayGrow(arr, arr->size + 1);
+
+    // shift elements to the right in one move (nothing to move for a tail insert)
+    memmove(arr->array + index + 1, arr->array + index, (arr->size - index) * sizeof(void *));
+
+    arr->array[index] = element; // add element at its index
+    arr->size++; // increase size
 }
 
 /*
- * Gets the size of the linked list
+ * Adds an element to the end of the array, amortised O(1)
+ */
+void arrayPush(Array *arr, void *element) {
+    arrayGrow(arr, arr->size + 1);
+    arr->array[arr->size] = element;
+    arr->size++;
+}
+
+/*
+ * Removes and returns the last element, or NULL if the array is empty
+ */
+void *arrayPop(Array *arr) {
+    if (arr->size == 0) {
+        fprintf(stderr, "Array is empty. Cannot pop element.\n");
+        return NULL;
+    }
+    arr->size--;
+    return arr->array[arr->size];
+}
+
+/*
+ * Removes and returns the element at index, shifting later elements left
+ */
+void *arrayRemoveAt(Array *arr, size_t index) {
+    if (index >= arr->size) {
+        fprintf(stderr, "Index (%zu) out of bounds for array size (%zu)", index, arr->size);
+        exit(EXIT_FAILURE);
+    }
+    void *element = arr->array[index];
+    memmove(arr->array + index, arr->array + index + 1, (arr->size - index - 1) * sizeof(void *));
+    arr->size--;
+    return element;
+}
+
+/*
+ * Removes and returns the element at index in O(1) by moving the last element
+ * into its place. Does not preserve order
+ */
+void *arraySwapRemove(Array *arr, size_t index) {
+    if (index >= arr->size) {
+        fprintf(stderr, "Index (%zu) out of bounds for array size (%zu)", index, arr->size);
+        exit(EXIT_FAILURE);
+    }
+    void *element = arr->array[index];
+    arr->size--;
+    arr->array[index] = arr->array[arr->size];
+    return element;
+}
+
+/*
+ * Makes room for at least capacity elements so later inserts don't reallocate
+ */
+void arrayReserve(Array *arr, size_t capacity) {
+    if (capacity <= arr->capacity) {
+        return;
+    }
+    size_t oldCapacity = arr->capacity;
+    uint64_t start = ADT_CYCLES();
+    void **array = (void **) reallocWith(arr->allocator, arr->array, arr->capacity * sizeof(void *),
+                                         capacity * sizeof(void *));
+    if (array == NULL) {
+        fprintf(stderr, "Reallocation error reserving (%zu) elements in dynamic array.", capacity);
+        exit(EXIT_FAILURE);
+    }
+    arr->array = array;
+    arr->capacity = capacity;
+    arrayReallocated(arr, oldCapacity, start);
+}
+
+/*
+ * Releases unused capacity so the backing store holds exactly size elements
+ */
+void arrayShrinkToFit(Array *arr) {
+    if (arr->size == arr->capacity) {
+        return;
+    }
+    if (arr->size == 0) {
+        releaseWith(arr->allocator, arr->array, arr->capacity * sizeof(void *));
+        arr->array = NULL;
+        arr->capacity = 0;
+        return;
+    }
+    size_t oldCapacity = arr->capacity;
+    uint64_t start = ADT_CYCLES();
+    void **array = (void **) reallocWith(arr->allocator, arr->array, arr->capacity * sizeof(void *),
+                                         arr->size * sizeof(void *));
+    if (array == NULL) {
+        fprintf(stderr, "Reallocation error shrinking dynamic array to (%zu) elements.", arr->size);
+        exit(EXIT_FAILURE);
+    }
+    arr->array = array;
+    arr->capacity = arr->size;
+    arrayReallocated(arr, oldCapacity, start);
+}
+
+/*
+ * Appends n elements to the end of the array with at most one reallocation
+ * and a single copy
+ */
+void arrayAppendMany(Array *arr, void **elements, size_t n) {
+    if (n == 0) {
+        return;
+    }
+    arrayGrow(arr, arr->size + n);
+    memcpy(arr->array + arr->size, elements, n * sizeof(void *));
+    arr->size += n;
+}
+
+/*
+ * Gets element at index
+ */
+void *getArrayElement(Array *arr, size_t index) {
+    if (index < arr->size) {
+        return arr->array[index];
+    }
+    return NULL;
+}
+
+/*
+ * Free up space after usage.
+ */
+void freeArray(Array *arr) {
+    releaseWith(arr->allocator, arr->array, arr->capacity * sizeof(void *));
+    arr->array = NULL;
+    arr->size = 0;
+    arr->capacity = 0;
+}
+
+/*
+ * Copies out the array's counters. Returns false (and zeroes counters) when the
+ * library was built without ADTOOL_INSTRUMENT
+ */
+bool arrayCounters(const Array *arr, ArrayCounters *counters) {
+#ifdef ADTOOL_INSTRUMENT
+    *counters = arr->counters;
+    return true;
+#else
+    (void)arr;
+    *counters = (ArrayCounters){ 0 };
+    return false;
+#endif
+}
+
+// ||------------------||
+// || ARRAY ALGORITHMS ||
+// ||------------------||
+
+/// Runs shorter than this are insertion sorted before merging
+#define SORT_RUN 32
+
+/*
+ * Number of worker threads worth using for n elements (1 means stay serial)
+ */
+static size_t arrayThreads(size_t n) {
+    if (n < ARRAY_PARALLEL_THRESHOLD) {
+        return 1;
+    }
+    size_t threads = ARRAY_MAX_THREADS;
+#if defined(_SC_NPROCESSORS_ONLN)
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    if (online > 0 && (size_t)online < threads) {
+        threads = (size_t)online;
+    }
+#endif
+    // keep every thread's share at or above half the threshold
+    size_t most = n / (ARRAY_PARALLEL_THRESHOLD / 2);
+    return threads < most ? threads : most;
+}
+
+/*
+ * Runs work on each of count tasks (laid out taskSize bytes apart), one thread
+ * per task with the first on the calling thread, and waits for all of them
+ */
+static void runTasks(void *(*work)(void *), void *tasks, size_t taskSize, size_t count) {
+    pthread_t threads[ARRAY_MAX_THREADS];
+    bool started[ARRAY_MAX_THREADS];
+    char *task = (char *)tasks;
+    for (size_t i = 1; i < count; i++) {
+        started[i] = pthread_create(&threads[i], NULL, work, task + i * taskSize) == 0;
+        if (!started[i]) {
+            work(task + i * taskSize); // no thread available, do it here
+        }
+    }
+    work(task);
+    for (size_t i = 1; i < count; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+}
+
+/*
+ * Merges the sorted runs src[lo, mid) and src[mid, hi) into dst[lo, hi)
+ */
+static void mergeRuns(void **src, void **dst, size_t lo, size_t mid, size_t hi,
+                      int (*compare)(const void *a, const void *b)) {
+    size_t i = lo, j = mid, k = lo;
+    while (i < mid && j < hi) {
+        // taking from the left run on ties keeps the sort stable
+        dst[k++] = compare(src[j], src[i]) < 0 ? src[j++] : src[i++];
+    }
+    memcpy(dst + k, src + i, (mid - i) * sizeof(void *));
+    memcpy(dst + k + (mid - i), src + j, (hi - j) * sizeof(void *));
+}
+
+/*
+ * Stable bottom-up merge sort of a[0, n) using tmp (n slots) as scratch.
+ * The result always ends up back in a
+ */
+static void mergeSort(void **a, void **tmp, size_t n, int (*compare)(const void *a, const void *b)) {
+    for (size_t lo = 0; lo < n; lo += SORT_RUN) {
+        size_t hi = lo + SORT_RUN < n ? lo + SORT_RUN : n;
+        for (size_t i = lo + 1; i < hi; i++) {
+            void *element = a[i];
+            size_t j = i;
+            while (j > lo && compare(element, a[j - 1]) < 0) {
+                a[j] = a[j - 1];
+                j--;
+            }
+            a[j] = element;
+        }
+    }
+    void **src = a;
+    void **dst = tmp;
+    for (size_t width = SORT_RUN; width < n; width *= 2) {
+        for (size_t lo = 0; lo < n; lo += 2 * width) {
+            size_t mid = lo + width < n ? lo + width : n;
+            size_t hi = lo + 2 * width < n ? lo + 2 * width : n;
+            mergeRuns(src, dst, lo, mid, hi, compare);
+        }
+        void **swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if (src != a) {
+        memcpy(a, src, n * sizeof(void *));
+    }
+}
+
+/*
+ * Allocates n slots of scratch space for sorting
+ */
+static void **sortScratch(size_t n) {
+    void **tmp = (void **)malloc(n * sizeof(void *));
+    if (tmp == NULL) {
+        fprintf(stderr, "Memory allocation failed creating sort buffer for (%zu) elements.", n);
+        exit(EXIT_FAILURE);
+    }
+    return tmp;
+}
+
+/*
+ * Stable sort of the array's elements. compare receives two elements
+ */
+void arraySort(Array *arr, int (*compare)(const void *a, const void *b)) {
+    if (arr->size < 2) {
+        return;
+    }
+    void **tmp = sortScratch(arr->size);
+    mergeSort(arr->array, tmp, arr->size, compare);
+    free(tmp);
+}
+
+typedef struct {
+    void **src;
+    void **dst;
+    size_t lo;
+    size_t mid;
+    size_t hi;
+    int (*compare)(const void *a, const void *b);
+} SortTask;
+
+static void *sortChunk(void *arg) {
+    SortTask *task = (SortTask *)arg;
+    mergeSort(task->src + task->lo, task->dst + task->lo, task->hi - task->lo, task->compare);
+    return NULL;
+}
+
+static void *mergeChunk(void *arg) {
+    SortTask *task = (SortTask *)arg;
+    mergeRuns(task->src, task->dst, task->lo, task->mid, task->hi, task->compare);
+    return NULL;
+}
+
+/*
+ * Stable sort split across worker threads: each sorts a chunk, then pairs of
+ * chunks are merged in parallel until one run is left. Small arrays are sorted
+ * on the calling thread
+ */
+void arrayParallelSort(Array *arr, int (*compare)(const void *a, const void *b)) {
+    size_t n = arr->size;
+    size_t threads = arrayThreads(n);
+    if (threads < 2) {
+        arraySort(arr, compare);
+        return;
+    }
+    // a power of two number of chunks merges down evenly
+    size_t chunks = 1;
+    while (chunks * 2 <= threads) {
+        chunks *= 2;
+    }
+    void **tmp = sortScratch(n);
+    SortTask tasks[ARRAY_MAX_THREADS];
+    for (size_t i = 0; i < chunks; i++) {
+        tasks[i] = (SortTask){ arr->array, tmp, n * i / chunks, 0, n * (i + 1) / chunks, compare };
+    }
+    runTasks(sortChunk, tasks, sizeof(SortTask), chunks);
+
+    void **src = arr->array;
+    void **dst = tmp;
+    for (size_t width = 1; width < chunks; width *= 2) {
+        size_t merges = 0;
+        for (size_t i = 0; i < chunks; i += 2 * width) {
+            tasks[merges++] = (SortTask){ src, dst, n * i / chunks, n * (i + width) / chunks,
+                                          n * (i + 2 * width) / chunks, compare };
+        }
+        runTasks(mergeChunk, tasks, sizeof(SortTask), merges);
+        void **swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if (src != arr->array) {
+        memcpy(arr->array, src, n * sizeof(void *));
+    }
+    free(tmp);
+}
+
+/*
+ * Binary search of an array sorted by compare, which receives the key and an
+ * element. Sets index to the first element not less than key and returns
+ * whether that element matches
+ */
+bool arrayBinarySearch(Array *arr, const void *key, int (*compare)(const void *key, const void *element),
+                       size_t *index) {
+    size_t lo = 0;
+    size_t hi = arr->size;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (compare(key, arr->array[mid]) > 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (index != NULL) {
+        *index = lo;
+    }
+    return lo < arr->size && compare(key, arr->array[lo]) == 0;
+}
+
+typedef struct {
+    void **array;
+    size_t begin;
+    size_t end;
+    void *(*map)(void *element, void *ctx);
+    void *(*reduce)(void *acc, void *element, void *ctx);
+    void *ctx;
+    void *result;
+} ArrayTask;
+
+static void *mapChunk(void *arg) {
+    ArrayTask *task = (ArrayTask *)arg;
+    for (size_t i = task->begin; i < task->end; i++) {
+        task->array[i] = task->map(task->array[i], task->ctx);
+    }
+    return NULL;
+}
+
+static void *reduceChunk(void *arg) {
+    ArrayTask *task = (ArrayTask *)arg;
+    void *acc = task->result;
+    for (size_t i = task->begin; i < task->end; i++) {
+        acc = task->reduce(acc, task->array[i], task->ctx);
+    }
+    task->result = acc;
+    return NULL;
+}
+
+/*
+ * Splits [0, n) into one ArrayTask per thread
+ */
+static size_t splitTasks(Array *arr, ArrayTask *tasks, ArrayTask proto) {
+    size_t count = arrayThreads(arr->size);
+    for (size_t i = 0; i < count; i++) {
+        tasks[i] = proto;
+        tasks[i].array = arr->array;
+        tasks[i].begin = arr->size * i / count;
+        tasks[i].end = arr->size * (i + 1) / count;
+    }
+    return count;
+}
+
+/*
+ * Replaces every element with map(element, ctx), in parallel for large arrays.
+ * map must be safe to call from several threads at once
+ */
+void arrayMap(Array *arr, void *(*map)(void *element, void *ctx), void *ctx) {
+    ArrayTask tasks[ARRAY_MAX_THREADS];
+    size_t count = splitTasks(arr, tasks, (ArrayTask){ .map = map, .ctx = ctx });
+    runTasks(mapChunk, tasks, sizeof(ArrayTask), count);
+}
+
+/*
+ * Folds the elements into init with reduce(acc, element, ctx). Large arrays are
+ * reduced in parallel chunks that each start from init and are then folded
+ * together in order, so reduce must be associative and init its identity
+ */
+void *arrayReduce(Array *arr, void *init, void *(*reduce)(void *acc, void *element, void *ctx), void *ctx) {
+    ArrayTask tasks[ARRAY_MAX_THREADS];
+    size_t count = splitTasks(arr, tasks, (ArrayTask){ .reduce = reduce, .ctx = ctx, .result = init });
+    runTasks(reduceChunk, tasks, sizeof(ArrayTask), count);
+    void *acc = tasks[0].result;
+    for (size_t i = 1; i < count; i++) {
+        acc = reduce(acc, tasks[i].result, ctx);
+    }
+    return acc;
+}
+
+// ||---------------||
+// ||   HASH TABLE  ||
+// ||---------------||
+
+/// Swiss control byte for a bucket that has never held an entry
+#define CTRL_EMPTY ((uint8_t)0x80)
+/// Swiss control byte for a removed entry (tombstone)
+#define CTRL_DELETED ((uint8_t)0xFE)
+
+/// Bucket array plus (for swiss tables) its control bytes. A table normally
+/// has one; during an incremental rehash the old one is drained into the new
+typedef struct {
+    Bucket *table;
+    uint8_t *ctrl; // swiss only: one control byte per bucket
+    size_t capacity; // always a power of two
+    size_t tombstones; // removed entries still occupying their bucket
+    size_t probes[HT_PROBE_HISTOGRAM]; // entries by distance from their home bucket
+    size_t maxProbe; // longest distance of any entry placed in this array
+} BucketArray;
+
+/// Bucket of a snapshot file. Offsets are from the start of the file, and a
+/// key offset of 0 marks an empty bucket (offset 0 is the header)
+typedef struct {
+    uint64_t hash;
+    uint64_t keyOffset;
+    uint64_t valueOffset; // 0 for a NULL value
+    uint64_t keySize; // bytes written for the key, checked against the file when opened
+    uint64_t valueSize;
+} SnapshotBucket;
+
+/// A snapshot opened by ht_open_mapped: the file's bytes (mapped, or read into
+/// memory where mmap is unavailable) and the bucket array inside them
+typedef struct {
+    const unsigned char *base;
+    size_t length;
+    const SnapshotBucket *buckets;
+    size_t capacity; // power of two
+    bool isMapped;
+} Snapshot;
+
+/// Key types whose hash and equals the table calls inline instead of through
+/// the user's function pointers
+typedef enum {
+    KEYS_CUSTOM,
+    KEYS_STR,
+    KEYS_U64
+} KeyKind;
+
+struct hashtab_s {
+    BucketArray buckets;
+    BucketArray old; // array being migrated from, table is NULL when not rehashing
+    size_t migrated; // buckets of old already moved over
+    bool incremental;
+    size_t size;
+    size_t rehashes;
+    uint64_t resizeNanos; // time spent allocating and migrating bucket arrays
+    size_t bytes; // bytes currently allocated by the table
+    const Allocator *allocator; // never NULL
+    HashProbe probe;
+    Snapshot *snapshot; // non-NULL for a read-only table from ht_open_mapped
+    KeyKind keys; // picked from hash/equals at creation
+#ifdef ADTOOL_INSTRUMENT
+    HashCounters counters;
+#endif
+    size_t (*hash)(const void *key);
+    // these three are user defined!!
+    bool (*equals)(const void *key1, const void *key2);
+    void (*print)(const void *key, const void *value);
+    void (*delete)(void *key, void *value);
+};
+
+/*
+ * Calculates load factor for the hash table based on current size and capacity
+ */
+static double loadFactor(HashADT t) {
+    return (double)t->size / t->buckets.capacity;
+}
+
+/// wyhash constants (Wang Yi, public domain)
+#define WY_P0 0xa0761d6478bd642full
+#define WY_P1 0xe7037ed1a0b428dbull
+#define WY_P2 0x8ebc6af09c88c6e3ull
+#define WY_P3 0x589965cc75374cc3ull
+
+/*
+ * 64x64 -> 128 bit multiply, leaving the low half in *a and the high in *b
+ */
+static inline void wyMum(uint64_t *a, uint64_t *b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+/*
+ * The 128 bit product folded back to 64 bits by xoring its halves
+ */
+static inline uint64_t wyMix(uint64_t a, uint64_t b) {
+    wyMum(&a, &b);
+    return a ^ b;
+}
+
+static inline uint64_t wyRead8(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t wyRead4(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/*
+ * wyhash of length bytes: a few wide multiplies per 48 bytes, and short keys
+ * (most of them) hashed from two overlapping reads without a loop
+ */
+static inline uint64_t hashBytes(const void *data, size_t length, uint64_t seed) {
+    const unsigned char *p = (const unsigned char *)data;
+    uint64_t a;
+    uint64_t b;
+    seed ^= wyMix(seed ^ WY_P0, WY_P1);
+    if (length <= 16) {
+        if (length >= 4) {
+            size_t mid = (length >> 3) << 2;
+            a = (wyRead4(p) << 32) | wyRead4(p + mid);
+            b = (wyRead4(p + length - 4) << 32) | wyRead4(p + length - 4 - mid);
+        } else if (length > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[length >> 1] << 8) | p[length - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = length;
+        if (i > 48) {
+            uint64_t see1 = seed;
+            uint64_t see2 = seed;
+            do {
+                seed = wyMix(wyRead8(p) ^ WY_P1, wyRead8(p + 8) ^ seed);
+                see1 = wyMix(wyRead8(p + 16) ^ WY_P2, wyRead8(p + 24) ^ see1);
+                see2 = wyMix(wyRead8(p + 32) ^ WY_P3, wyRead8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = wyMix(wyRead8(p) ^ WY_P1, wyRead8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = wyRead8(p + i - 16);
+        b = wyRead8(p + i - 8);
+    }
+    a ^= WY_P1;
+    b ^= seed;
+    wyMum(&a, &b);
+    return wyMix(a ^ WY_P0 ^ length, b ^ WY_P1);
+}
+
+/*
+ * Finalizer for integer keys (splitmix64): every input bit reaches every output bit
+ */
+static inline uint64_t mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+uint64_t ht_hash_bytes(const void *data, size_t length, uint64_t seed) {
+    return hashBytes(data, length, seed);
+}
+
+size_t ht_hash_str(const void *key) {
+    return (size_t)hashBytes(key, strlen((const char *)key), 0);
+}
+
+bool ht_equals_str(const void *key1, const void *key2) {
+    return strcmp((const char *)key1, (const char *)key2) == 0;
+}
+
+size_t ht_hash_u64(const void *key) {
+    return (size_t)mix64(*(const uint64_t *)key);
+}
+
+bool ht_equals_u64(const void *key1, const void *key2) {
+    return *(const uint64_t *)key1 == *(const uint64_t *)key2;
+}
+
+size_t ht_hash_ptr(const void *key) {
+    return (size_t)mix64((uint64_t)(uintptr_t)key);
+}
+
+/*
+ * Hashes key, inline for the built-in key kinds
+ */
+static inline size_t hashKey(const HashADT t, const void *key) {
+    switch (t->keys) {
+        case KEYS_STR:
+            return (size_t)hashBytes(key, strlen((const char *)key), 0);
+        case KEYS_U64:
+            return (size_t)mix64(*(const uint64_t *)key);
+        default:
+            return t->hash(key);
+    }
+}
+
+/*
+ * Compares a probed key with a stored one, inline for the built-in key kinds
+ */
+static inline bool keysEqual(const HashADT t, const void *key, const void *stored) {
+    switch (t->keys) {
+        case KEYS_STR:
+            return strcmp((const char *)key, (const char *)stored) == 0;
+        case KEYS_U64:
+            return *(const uint64_t *)key == *(const uint64_t *)stored;
+        default:
+            return t->equals(key, stored);
+    }
+}
+
+/*
+ * Exits if t is a read-only snapshot
+ */
+static void requireWritable(const HashADT t) {
+    if (t->snapshot != NULL) {
+        fprintf(stderr, "Cannot modify a table opened with ht_open_mapped\n");
+        exit(1);
+    }
+}
+
+/*
+ * Spreads a user hash over all bits so swiss tags and groups stay independent
+ * even for weak hashes (e.g. identity on small integers)
+ */
+static inline uint64_t swissMix(size_t hash) {
+    uint64_t h = (uint64_t)hash * 0x9E3779B97F4A7C15ull;
+    return h ^ (h >> 32);
+}
+
+/*
+ * 7-bit tag stored in the control byte of a full swiss bucket
+ */
+static inline uint8_t swissTag(size_t hash) {
+    return (uint8_t)(swissMix(hash) & 0x7F);
+}
+
+/*
+ * Index of the group a hash starts probing from
+ */
+static inline size_t swissHomeGroup(size_t hash, size_t capacity) {
+    return (size_t)(swissMix(hash) >> 7) & (capacity / HT_GROUP_WIDTH - 1);
+}
+
+/*
+ * Bitmask of the slots in a group whose control byte equals tag
+ */
+static inline uint32_t groupMatch(const uint8_t *group, uint8_t tag) {
+#if defined(__SSE2__) || defined(_M_X64)
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)tag)));
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    static const uint8_t lanes[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t eq = vceqq_u8(vld1q_u8(group), vdupq_n_u8(tag));
+    uint8x16_t bits = vandq_u8(eq, vld1q_u8(lanes));
+    return (uint32_t)vaddv_u8(vget_low_u8(bits)) | ((uint32_t)vaddv_u8(vget_high_u8(bits)) << 8);
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < HT_GROUP_WIDTH; i++) {
+        mask |= (uint32_t)(group[i] == tag) << i;
+    }
+    return mask;
+#endif
+}
+
+/*
+ * Bitmask of the slots in a group that are empty or tombstones (high bit set)
+ */
+static inline uint32_t groupMatchFree(const uint8_t *group) {
+#if defined(__SSE2__) || defined(_M_X64)
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    static const uint8_t lanes[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t high = vcltq_s8(vreinterpretq_s8_u8(vld1q_u8(group)), vdupq_n_s8(0));
+    uint8x16_t bits = vandq_u8(high, vld1q_u8(lanes));
+    return (uint32_t)vaddv_u8(vget_low_u8(bits)) | ((uint32_t)vaddv_u8(vget_high_u8(bits)) << 8);
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < HT_GROUP_WIDTH; i++) {
+        mask |= (uint32_t)(group[i] >= CTRL_EMPTY) << i;
+    }
+    return mask;
+#endif
+}
+
+/*
+ * Position of the lowest set bit of a non-zero group mask
+ */
+static inline size_t firstSet(uint32_t mask) {
+#if defined(__GNUC__)
+    return (size_t)__builtin_ctz(mask);
+#else
+    size_t i = 0;
+    while ((mask & 1) == 0) {
+        mask >>= 1;
+        i++;
+    }
+    return i;
+#endif
+}
+
+/*
+ * Returns whether bucket i of an array currently holds an entry
+ */
+static inline bool isFull(const HashADT t, const BucketArray *b, size_t i) {
+    if (t->probe == HT_PROBE_SWISS) {
+        return b->ctrl[i] < CTRL_EMPTY;
+    }
+    return b->table[i].isOccupied;
+}
+
+/*
+ * Returns whether the entry in bucket i sits outside its home slot (or group)
+ */
+static bool isDisplaced(const HashADT t, const BucketArray *b, size_t i) {
+    size_t hash = b->table[i].hash;
+    if (t->probe == HT_PROBE_SWISS) {
+        return i / HT_GROUP_WIDTH != swissHomeGroup(hash, b->capacity);
+    }
+    return i != (hash & (b->capacity - 1));
+}
+
+#ifdef ADTOOL_INSTRUMENT
+/*
+ * Books one lookup. probesBefore is the probe counter when it started
+ */
+static void countLookup(const HashADT t, uint64_t probesBefore, bool hit) {
+    uint64_t probes = t->counters.probes - probesBefore;
+    t->counters.lookups++;
+    t->counters.misses += !hit;
+    if (probes > t->counters.longestProbe) {
+        t->counters.longestProbe = probes;
+    }
+}
+
+/// Bracket the probes of one lookup; the find helpers count the probes themselves
+#define HT_LOOKUP_BEGIN(t) uint64_t probesBefore = (t)->counters.probes
+#define HT_LOOKUP_END(t, hit) countLookup(t, probesBefore, hit)
+#else
+#define HT_LOOKUP_BEGIN(t) ((void)0)
+#define HT_LOOKUP_END(t, hit) ((void)0)
+#endif
+
+/*
+ * Load at which the table grows for its engine
+ */
+static inline double maxLoad(const HashADT t) {
+    return t->probe == HT_PROBE_ROBINHOOD ? HT_ROBINHOOD_LOAD_THRESHOLD : LOAD_THRESHOLD;
+}
+
+/*
+ * Slots bucket index sits past the home slot of hash (linear and Robin Hood)
+ */
+static inline size_t slotDistance(const BucketArray *b, size_t index, size_t hash) {
+    return (index - hash) & (b->capacity - 1);
+}
+
+/*
+ * Robin Hood search: gives up at an empty bucket or as soon as it meets an entry
+ * closer to its home than the key would be, since an insert would have
+ * displaced that entry. Tombstones (left only in an array being migrated
+ * from) never stop the search. With slot set, a miss also reports the bucket
+ * the key would be inserted at
+ */
+static size_t robinHoodFind(const HashADT t, const BucketArray *b, const void *key, size_t hash, size_t *slot) {
+    size_t mask = b->capacity - 1;
+    size_t index = hash & mask;
+    for (size_t distance = 0; distance <= mask; distance++) {
+        ADT_COUNT(t->counters.probes);
+        const Bucket *bucket = &b->table[index];
+        if (bucket->isOccupied) {
+            if (bucket->hash == hash && keysEqual(t, key, bucket->pair.key)) {
+                return index;
+            }
+            if (slotDistance(b, index, bucket->hash) < distance) {
+                break;
+            }
+        } else if (!bucket->isDeleted) {
+            break;
+        }
+        index = (index + 1) & mask;
+    }
+    if (slot != NULL) {
+        *slot = index;
+    }
+    return HT_NOT_FOUND;
+}
+
+/*
+ * Finds the bucket of an array holding key, or HT_NOT_FOUND
+ */
+static size_t findIndex(const HashADT t, const BucketArray *b, const void *key, size_t hash) {
+    size_t mask = b->capacity - 1;
+    if (t->probe == HT_PROBE_ROBINHOOD) {
+        return robinHoodFind(t, b, key, hash, NULL);
+    }
+    if (t->probe == HT_PROBE_SWISS) {
+        size_t groupMask = b->capacity / HT_GROUP_WIDTH - 1;
+        size_t group = swissHomeGroup(hash, b->capacity);
+        uint8_t tag = swissTag(hash);
+        // triangular steps over power of two groups visit every group once
+        for (size_t step = 1; step <= groupMask + 1; step++) {
+            ADT_COUNT(t->counters.probes);
+            const uint8_t *ctrl = b->ctrl + group * HT_GROUP_WIDTH;
+            for (uint32_t m = groupMatch(ctrl, tag); m != 0; m &= m - 1) {
+                size_t index = group * HT_GROUP_WIDTH + firstSet(m);
+                if (b->table[index].hash == hash && keysEqual(t, key, b->table[index].pair.key)) {
+                    return index;
+                }
+            }
+            // a group with an empty slot ends every probe sequence through it
+            if (groupMatch(ctrl, CTRL_EMPTY) != 0) {
+                return HT_NOT_FOUND;
+            }
+            group = (group + step) & groupMask;
+        }
+        return HT_NOT_FOUND;
+    }
+
+    size_t index = hash & mask;
+    // tombstones keep the probe sequence going but never match
+    while (b->table[index].isOccupied || b->table[index].isDeleted) {
+        ADT_COUNT(t->counters.probes);
+        // only call the user's equals when the cached hashes match
+        if (b->table[index].isOccupied && b->table[index].hash == hash
+            && keysEqual(t, key, b->table[index].pair.key)) {
+            return index;
+        }
+        index = (index + 1) & mask;
+    }
+    ADT_COUNT(t->counters.probes); // the free bucket that ended the search
+    return HT_NOT_FOUND;
+}
+
+/*
+ * Finds a free bucket for a hash whose key is known not to be in the array,
+ * reusing the first tombstone on the probe sequence
+ */
+static size_t findSlot(const HashADT t, const BucketArray *b, size_t hash) {
+    if (t->probe == HT_PROBE_SWISS) {
+        size_t groupMask = b->capacity / HT_GROUP_WIDTH - 1;
+        size_t group = swissHomeGroup(hash, b->capacity);
+        for (size_t step = 1; ; step++) {
+            uint32_t avail = groupMatchFree(b->ctrl + group * HT_GROUP_WIDTH);
+            if (avail != 0) {
+                return group * HT_GROUP_WIDTH + firstSet(avail);
+            }
+            group = (group + step) & groupMask;
+        }
+    }
+
+    size_t mask = b->capacity - 1;
+    size_t index = hash & mask;
+    while (b->table[index].isOccupied) {
+        index = (index + 1) & mask;
+    }
+    return index;
+}
+
+/*
+ * One probe that either finds key or, if it is absent, also yields the free
+ * bucket findSlot would have picked for it in *slot
+ */
+static size_t findIndexOrSlot(const HashADT t, const BucketArray *b, const void *key, size_t hash, size_t *slot) {
+    if (t->probe == HT_PROBE_ROBINHOOD) {
+        return robinHoodFind(t, b, key, hash, slot);
+    }
+    if (t->probe == HT_PROBE_SWISS) {
+        size_t groupMask = b->capacity / HT_GROUP_WIDTH - 1;
+        size_t group = swissHomeGroup(hash, b->capacity);
+        uint8_t tag = swissTag(hash);
+        *slot = HT_NOT_FOUND;
+        for (size_t step = 1; step <= groupMask + 1; step++) {
+            ADT_COUNT(t->counters.probes);
+            const uint8_t *ctrl = b->ctrl + group * HT_GROUP_WIDTH;
+            for (uint32_t m = groupMatch(ctrl, tag); m != 0; m &= m - 1) {
+                size_t index = group * HT_GROUP_WIDTH + firstSet(m);
+                if (b->table[index].hash == hash && keysEqual(t, key, b->table[index].pair.key)) {
+                    return index;
+                }
+            }
+            uint32_t avail = groupMatchFree(ctrl);
+            if (*slot == HT_NOT_FOUND && avail != 0) {
+                *slot = group * HT_GROUP_WIDTH + firstSet(avail);
+            }
+            if (groupMatch(ctrl, CTRL_EMPTY) != 0) {
+                return HT_NOT_FOUND;
+            }
+            group = (group + step) & groupMask;
+        }
+        return HT_NOT_FOUND;
+    }
+
+    size_t mask = b->capacity - 1;
+    size_t index = hash & mask;
+    size_t tombstone = HT_NOT_FOUND;
+    while (b->table[index].isOccupied || b->table[index].isDeleted) {
+        ADT_COUNT(t->counters.probes);
+        if (b->table[index].isOccupied) {
+            if (b->table[index].hash == hash && keysEqual(t, key, b->table[index].pair.key)) {
+                return index;
+            }
+        } else if (tombstone == HT_NOT_FOUND) {
+            tombstone = index;
+        }
+        index = (index + 1) & mask;
+    }
+    ADT_COUNT(t->counters.probes);
+    *slot = tombstone != HT_NOT_FOUND ? tombstone : index;
+    return HT_NOT_FOUND;
+}
+
+/*
+ * Distance of bucket index from the home of hash: slots for linear probing,
+ * probe steps between groups for swiss tables
+ */
+static size_t probeDistance(const HashADT t, const BucketArray *b, size_t index, size_t hash) {
+    if (t->probe == HT_PROBE_SWISS) {
+        size_t groupMask = b->capacity / HT_GROUP_WIDTH - 1;
+        size_t group = swissHomeGroup(hash, b->capacity);
+        size_t steps = 0;
+        while (group != index / HT_GROUP_WIDTH) {
+            steps++;
+            group = (group + steps) & groupMask;
+        }
+        return steps;
+    }
+    return slotDistance(b, index, hash);
+}
+
+/*
+ * Adds or removes an entry at distance from an array's probe histogram
+ */
+static void trackProbe(BucketArray *b, size_t distance, bool add) {
+    size_t slot = distance < HT_PROBE_HISTOGRAM ? distance : HT_PROBE_HISTOGRAM - 1;
+    if (add) {
+        b->probes[slot]++;
+        if (distance > b->maxProbe) {
+            b->maxProbe = distance;
+        }
+    } else {
+        b->probes[slot]--;
+    }
+}
+
+/*
+ * Stores a pair in a free bucket
+ */
+static void placeEntry(const HashADT t, BucketArray *b, size_t index,
+                       const void *key, const void *value, size_t hash) {
+    bool tombstone = t->probe == HT_PROBE_SWISS ? b->ctrl[index] == CTRL_DELETED : b->table[index].isDeleted;
+    if (tombstone) {
+        b->tombstones--;
+    }
+    b->table[index].pair.key = key;
+    b->table[index].pair.value = value;
+    b->table[index].hash = hash;
+    b->table[index].isOccupied = true;
+    b->table[index].isDeleted = false;
+    if (t->probe == HT_PROBE_SWISS) {
+        b->ctrl[index] = swissTag(hash);
+    }
+    trackProbe(b, probeDistance(t, b, index, hash), true);
+}
+
+/*
+ * Robin Hood insert of a key known to be absent, starting at index (its home
+ * or the bucket robinHoodFind stopped at). Whenever the entry being carried
+ * is further from home than a bucket's resident, they swap and the resident
+ * is carried on instead. The new key ends up in the first bucket it claims
+ */
+static void robinHoodPlace(const HashADT t, BucketArray *b, size_t index,
+                           const void *key, const void *value, size_t hash) {
+    size_t mask = b->capacity - 1;
+    KeyValue pair = { key, value };
+    while (b->table[index].isOccupied) {
+        Bucket *resident = &b->table[index];
+        size_t distance = slotDistance(b, index, hash);
+        size_t theirs = slotDistance(b, index, resident->hash);
+        if (theirs < distance) {
+            KeyValue evicted = resident->pair;
+            size_t evictedHash = resident->hash;
+            trackProbe(b, theirs, false);
+            resident->pair = pair;
+            resident->hash = hash;
+            trackProbe(b, distance, true);
+            pair = evicted;
+            hash = evictedHash;
+        }
+        index = (index + 1) & mask;
+    }
+    placeEntry(t, b, index, pair.key, pair.value, hash);
+}
+
+/*
+ * Robin Hood delete: pulls each following displaced entry back one bucket
+ * until one is at home or the run ends, so no tombstone is needed
+ */
+static void backwardShift(BucketArray *b, size_t index) {
+    size_t mask = b->capacity - 1;
+    trackProbe(b, slotDistance(b, index, b->table[index].hash), false);
+    size_t next = (index + 1) & mask;
+    while (b->table[next].isOccupied && slotDistance(b, next, b->table[next].hash) > 0) {
+        size_t distance = slotDistance(b, next, b->table[next].hash);
+        trackProbe(b, distance, false);
+        trackProbe(b, distance - 1, true);
+        b->table[index] = b->table[next];
+        index = next;
+        next = (next + 1) & mask;
+    }
+    b->table[index].pair.key = NULL;
+    b->table[index].pair.value = NULL;
+    b->table[index].isOccupied = false;
+    b->table[index].isDeleted = false;
+}
+
+/*
+ * Empties a full bucket, leaving a tombstone when a probe sequence may run through it
+ */
+static void eraseEntry(const HashADT t, BucketArray *b, size_t index) {
+    // the array being migrated from keeps tombstones so the migration cursor
+    // never has entries shifted back past it
+    if (t->probe == HT_PROBE_ROBINHOOD && b == &t->buckets) {
+        backwardShift(b, index);
+        return;
+    }
+    trackProbe(b, probeDistance(t, b, index, b->table[index].hash), false);
+    b->table[index].pair.key = NULL;
+    b->table[index].pair.value = NULL;
+    b->table[index].isOccupied = false;
+    if (t->probe == HT_PROBE_SWISS) {
+        // no search ever continues past a group that still has an empty slot
+        const uint8_t *group = b->ctrl + index / HT_GROUP_WIDTH * HT_GROUP_WIDTH;
+        if (groupMatch(group, CTRL_EMPTY) != 0) {
+            b->ctrl[index] = CTRL_EMPTY;
+            return;
+        }
+        b->ctrl[index] = CTRL_DELETED;
+    } else {
+        b->table[index].isDeleted = true;
+    }
+    b->tombstones++;
+}
+
+/*
+ * Allocates empty buckets (and control bytes for swiss tables) for capacity
+ */
+static void allocBuckets(const HashADT t, BucketArray *b, size_t capacity) {
+    b->table = (Bucket *)allocZeroedWith(t->allocator, capacity * sizeof(Bucket));
+    if (b->table == NULL) {
+        fprintf(stderr, "Memory allocation failed creating table's buckets");
+        exit(1);
+    }
+    b->ctrl = NULL;
+    if (t->probe == HT_PROBE_SWISS) {
+        b->ctrl = (uint8_t *)t->allocator->allocate(t->allocator->ctx, capacity);
+        if (b->ctrl == NULL) {
+            fprintf(stderr, "Memory allocation failed creating table's control bytes");
+            exit(1);
+        }
+        memset(b->ctrl, CTRL_EMPTY, capacity);
+    }
+    b->capacity = capacity;
+    b->tombstones = 0;
+    memset(b->probes, 0, sizeof(b->probes));
+    b->maxProbe = 0;
+    t->bytes += capacity * sizeof(Bucket) + (b->ctrl != NULL ? capacity : 0);
+}
+
+/*
+ * Releases a bucket array
+ */
+static void freeBuckets(const HashADT t, BucketArray *b) {
+    if (b->table != NULL) {
+        t->bytes -= b->capacity * sizeof(Bucket) + (b->ctrl != NULL ? b->capacity : 0);
+    }
+    releaseWith(t->allocator, b->table, b->capacity * sizeof(Bucket));
+    releaseWith(t->allocator, b->ctrl, b->capacity);
+    b->table = NULL;
+    b->ctrl = NULL;
+}
+
+/*
+ * Moves up to count buckets of the old array into the current one, reusing
+ * their cached hashes. Moved buckets become tombstones so lookups that still
+ * probe the old array run past them; the old array is freed once drained
+ */
+static void migrate(const HashADT t, size_t count) {
+    uint64_t start = nowNanos();
+    uint64_t cycles = ADT_CYCLES();
+    BucketArray *old = &t->old;
+    size_t end = t->migrated + count < old->capacity ? t->migrated + count : old->capacity;
+    for (size_t i = t->migrated; i < end; i++) {
+        if (isFull(t, old, i)) {
+            Bucket *b = &old->table[i];
+            if (t->probe == HT_PROBE_ROBINHOOD) {
+                robinHoodPlace(t, &t->buckets, b->hash & (t->buckets.capacity - 1),
+                               b->pair.key, b->pair.value, b->hash);
+            } else {
+                placeEntry(t, &t->buckets, findSlot(t, &t->buckets, b->hash), b->pair.key, b->pair.value, b->hash);
+            }
+            // a full drain frees the array right after, so nothing probes it again
+            if (end < old->capacity) {
+                eraseEntry(t, old, i);
+            }
+        }
+    }
+    t->migrated = end;
+    if (t->migrated == old->capacity) {
+        freeBuckets(t, old);
+    }
+    t->resizeNanos += nowNanos() - start;
+    ADT_ADD(t->counters.rehashCycles, ADT_CYCLES() - cycles);
+}
+
+/*
+ * Function to resize the hashtable when needed, rebuilding it at newCapacity
+ * without any tombstones. In incremental mode this only swaps in the new
+ * array; the entries follow a few buckets at a time on later operations
+ */
+static void resize(HashADT t, size_t newCapacity) {
+    // a rehash still in flight is finished before starting the next one
+    if (t->old.table != NULL) {
+        migrate(t, t->old.capacity);
+    }
+    uint64_t start = nowNanos();
+    uint64_t cycles = ADT_CYCLES();
+    size_t oldCapacity = t->buckets.capacity;
+    t->rehashes++;
+    t->old = t->buckets;
+    t->migrated = 0;
+    allocBuckets(t, &t->buckets, newCapacity);
+    t->resizeNanos += nowNanos() - start;
+    ADT_ADD(t->counters.rehashCycles, ADT_CYCLES() - cycles);
+    if (!t->incremental) {
+        migrate(t, t->old.capacity);
+    }
+    // an incremental rehash reports only the swap, its migration is spread out
+    ADT_TRACE(ADT_TRACE_REHASH, t, oldCapacity, newCapacity, ADT_CYCLES() - cycles);
+}
+
+/*
+ * Smallest power of two capacity that holds n entries below the load threshold
+ */
+static size_t capacityFor(const HashADT t, size_t n) {
+    size_t capacity = INITIAL_CAPACITY;
+    while (capacity * maxLoad(t) < n) {
+        capacity *= RESIZE_FACTOR;
+    }
+    return capacity;
+}
+
+/*
+ * Creates a new HashADT instance
+ */
+HashADT ht_create(size_t (*hash)( const void *key),
+                  bool (*equals)(const void *key1, const void *key2),
+                  void (*print) ( const void *key, const void *value),
+                  void (*delete)(void *key, void *value)) {
+    return ht_create_probe(HT_PROBE_LINEAR, hash, equals, print, delete);
+}
+
+/*
+ * Creates a new HashADT instance using the given probing engine
+ */
+HashADT ht_create_probe(HashProbe probe,
+                        size_t (*hash)( const void *key),
+                        bool (*equals)(const void *key1, const void *key2),
+                        void (*print) ( const void *key, const void *value),
+                        void (*delete)(void *key, void *value)) {
+    return ht_create_alloc(NULL, probe, 0, hash, equals, print, delete);
+}
+
+/*
+ * Allocates and initializes a table handle with no bucket array yet
+ */
+static HashADT newTable(const Allocator *allocator, HashProbe probe,
+                        size_t (*hash)( const void *key),
+                        bool (*equals)(const void *key1, const void *key2),
+                        void (*print) ( const void *key, const void *value),
+                        void (*delete)(void *key, void *value)) {
+    allocator = allocatorOf(allocator);
+    HashADT t = (HashADT)allocator->allocate(allocator->ctx, sizeof(struct hashtab_s));
+    if (t == NULL) {
+        fprintf(stderr, "Memory allocation failed creating the hashtable");
+        exit(1);
+    }
+    t->allocator = allocator;
+    t->snapshot = NULL;
+    t->size = 0;
+    t->rehashes = 0;
+    t->resizeNanos = 0;
+#ifdef ADTOOL_INSTRUMENT
+    t->counters = (HashCounters){ 0 };
+#endif
+    t->bytes = sizeof(struct hashtab_s);
+    t->probe = probe;
+    t->incremental = false;
+    memset(&t->buckets, 0, sizeof(t->buckets));
+    t->old.table = NULL;
+    t->old.ctrl = NULL;
+    t->migrated = 0;
+    t->hash = hash;
+    t->equals = equals;
+    t->keys = KEYS_CUSTOM;
+    if (hash == ht_hash_str && equals == ht_equals_str) {
+        t->keys = KEYS_STR;
+    } else if (hash == ht_hash_u64 && equals == ht_equals_u64) {
+        t->keys = KEYS_U64;
+    }
+    t->print = print;
+    t->delete = delete;
+    return t;
+}
+
+/*
+ * Creates a new HashADT instance whose table and buckets come from allocator,
+ * sized up front for capacity entries
+ */
+HashADT ht_create_alloc(const Allocator *allocator, HashProbe probe, size_t capacity,
+                        size_t (*hash)( const void *key),
+                        bool (*equals)(const void *key1, const void *key2),
+                        void (*print) ( const void *key, const void *value),
+                        void (*delete)(void *key, void *value)) {
+    HashADT t = newTable(allocator, probe, hash, equals, print, delete);
+    allocBuckets(t, &t->buckets, capacityFor(t, capacity));
+    return t;
+}
+
+/*
+ * Creates a new HashADT instance sized up front to hold capacity entries
+ * without rehashing
+ */
+HashADT ht_create_sized(size_t capacity,
+                        size_t (*hash)( const void *key),
+                        bool (*equals)(const void *key1, const void *key2),
+                        void (*print) ( const void *key, const void *value),
+                        void (*delete)(void *key, void *value)) {
+    return ht_create_alloc(NULL, HT_PROBE_LINEAR, capacity, hash, equals, print, delete);
+}
+
+/*
+ * Creates a new HashADT keyed by NUL-terminated strings, hashed and compared
+ * inline
+ */
+HashADT ht_create_str(void (*print) ( const void *key, const void *value),
+                      void (*delete)(void *key, void *value)) {
+    return ht_create_alloc(NULL, HT_PROBE_LINEAR, 0, ht_hash_str, ht_equals_str, print, delete);
+}
+
+/*
+ * Creates a new HashADT whose keys point at uint64_t values, hashed and
+ * compared inline
+ */
+HashADT ht_create_u64(void (*print) ( const void *key, const void *value),
+                      void (*delete)(void *key, void *value)) {
+    return ht_create_alloc(NULL, HT_PROBE_LINEAR, 0, ht_hash_u64, ht_equals_u64, print, delete);
+}
+
+/*
+ * Grows the table once so it can hold n entries in total without further
+ * rehashing. Never shrinks the table
+ */
+void ht_reserve(HashADT t, size_t n) {
+    if (t == NULL) {
+        fprintf(stderr, "Invalid table to reserve\n");
+        exit(1);
+    }
+    requireWritable(t);
+    size_t capacity = capacityFor(t, n);
+    if (capacity > t->buckets.capacity) {
+        resize(t, capacity);
+        // a reserve is a bulk setup step, so it never leaves a migration behind
+        if (t->old.table != NULL) {
+            migrate(t, t->old.capacity);
+        }
+    }
+}
+
+/*
+ * Turns incremental rehashing on or off. When on, growing the table no longer
+ * moves every entry at once; each ht_put/ht_get/ht_remove migrates at most
+ * HT_MIGRATE_STEP old buckets until the old array is drained
+ */
+void ht_set_incremental(HashADT t, bool incremental) {
+    if (t == NULL) {
+        fprintf(stderr, "Invalid table to configure\n");
+        exit(1);
+    }
+    t->incremental = incremental;
+    if (!incremental && t->old.table != NULL) {
+        migrate(t, t->old.capacity);
+    }
+}
+
+/*
+ * Unmaps (or frees) a snapshot's bytes
+ */
+static void closeSnapshot(Snapshot *snap) {
+#if defined(ADTOOL_HAVE_MMAP)
+    if (snap->isMapped) {
+        munmap((void *)snap->base, snap->length);
+    } else {
+        free((void *)snap->base);
+    }
+#else
+    free((void *)snap->base);
+#endif
+    free(snap);
+}
+
+/*
+ * Destroys specified HashADT, deallocating any dynamic storage
+ */
+void ht_destroy( HashADT t) {
+    if (t == NULL) {
+        fprintf(stderr, "Invalid table to destroy\n");
+        exit(1);
+    }
+    BucketArray *arrays[2] = { &t->buckets, &t->old };
+    for (int a = 0; a < 2; a++) {
+        BucketArray *b = arrays[a];
+        for (size_t i = 0; b->table != NULL && i < b->capacity; i++) {
+            if (isFull(t, b, i) && t->delete != NULL) {
+                KeyValue *pair = &b->table[i].pair;
+                t->delete((void *)pair->key, (void *)pair->value);
+            }
+        }
+        freeBuckets(t, b);
+    }
+    if (t->snapshot != NULL) {
+        closeSnapshot(t->snapshot);
+    }
+    releaseWith(t->allocator, t, sizeof(struct hashtab_s));
+}
+
+/*
+ * Prints all required information about the hashtable
+ */
+void ht_dump(const HashADT t, bool contents) {
+    if (t == NULL) {
+        fprintf(stderr, "Invalid table to dump\n");
+        exit(1);
+    }
+    printf("Size: %zu\n", t->size);
+    if (t->snapshot != NULL) {
+        printf("Capacity: %zu\n", t->snapshot->capacity);
+        printf("Snapshot: %zu bytes%s\n", t->snapshot->length, t->snapshot->isMapped ? " (mapped)" : "");
+        HashIter it;
+        const void *key;
+        const void *value;
+        ht_iter_begin(t, &it);
+        while (contents && ht_iter_next(&it, &key, &value)) {
+            printf("( ");
+            t->print(key, value);
+            printf(" )\n");
+        }
+        return;
+    }
+    printf("Capacity: %zu\n", t->buckets.capacity);
+    if (t->old.table != NULL) {
+        printf("Migrating: %zu / %zu\n", t->migrated, t->old.capacity);
+    }
+
+    int collisions = 0;
+    if (contents) {
+        for (size_t i = 0; i < t->buckets.capacity; i++) {
+            if (isFull(t, &t->buckets, i) && isDisplaced(t, &t->buckets, i)) {
+                collisions++;
+            }
+        }
+        printf("Collisions: %d\n", collisions);
+        printf("Rehashes: %zu\n", t->rehashes);
+#ifdef ADTOOL_INSTRUMENT
+        printf("Lookups: %llu (%llu misses), %.2f probes each, longest %llu\n",
+               (unsigned long long)t->counters.lookups, (unsigned long long)t->counters.misses,
+               t->counters.lookups != 0 ? (double)t->counters.probes / t->counters.lookups : 0.0,
+               (unsigned long long)t->counters.longestProbe);
+#endif
+        for (size_t i = 0; i < t->buckets.capacity; i++) {
+            if (isFull(t, &t->buckets, i)) {
+                KeyValue *pair = &t->buckets.table[i].pair;
+                if (pair->key != NULL && pair->value != NULL) {
+                    printf("%zu : ( ", i);
+                    t->print(pair->key, pair->value);
+                    printf(" )\n");
+                }
+            } else {
+                printf("%zu : null\n", i);
+            }
+        }
+        // entries not yet migrated out of the old array
+        for (size_t i = t->migrated; t->old.table != NULL && i < t->old.capacity; i++) {
+            if (isFull(t, &t->old, i)) {
+                printf("old %zu : ( ", i);
+                t->print(t->old.table[i].pair.key, t->old.table[i].pair.value);
+                printf(" )\n");
+            }
+        }
+    }
+}
+
+/*
+ * Linear probe over a snapshot's buckets, straight out of the file's bytes
+ */
+static const void *snapshotGet(const HashADT t, const void *key, size_t hash) {
+    const Snapshot *snap = t->snapshot;
+    size_t mask = snap->capacity - 1;
+    size_t index = (size_t)hash & mask;
+    for (size_t step = 0; step <= mask; step++) {
+        const SnapshotBucket *b = &snap->buckets[index];
+        if (b->keyOffset == 0) {
+            break;
+        }
+        if (b->hash == (uint64_t)hash && keysEqual(t, key, snap->base + b->keyOffset)) {
+            return b->valueOffset != 0 ? snap->base + b->valueOffset : NULL;
+        }
+        index = (index + 1) & mask;
+    }
+    return NULL;
+}
+
+/*
+ * Locates key in either bucket array, advancing an in-flight migration first.
+ * Returns the bucket or NULL, and sets *owner to the array holding it
+ */
+static Bucket *lookup(const HashADT t, const void *key, size_t hash, BucketArray **owner) {
+    if (t->old.table != NULL) {
+        migrate(t, HT_MIGRATE_STEP);
+    }
+    HT_LOOKUP_BEGIN(t);
+    Bucket *found = NULL;
+    size_t index = findIndex(t, &t->buckets, key, hash);
+    if (index != HT_NOT_FOUND) {
+        *owner = &t->buckets;
+        found = &t->buckets.table[index];
+    } else if (t->old.table != NULL) {
+        index = findIndex(t, &t->old, key, hash);
+        if (index != HT_NOT_FOUND) {
+            *owner = &t->old;
+            found = &t->old.table[index];
+        }
+    }
+    HT_LOOKUP_END(t, found != NULL);
+    return found;
+}
+
+/*
+ * Gets value with specified key
+ */
+const void *ht_get(const HashADT t, const void *key) {
+    if (t->snapshot != NULL) {
+        return snapshotGet(t, key, hashKey(t, key));
+    }
+    BucketArray *owner;
+    Bucket *b = lookup(t, key, hashKey(t, key), &owner);
+    return b != NULL ? b->pair.value : NULL;
+}
+
+/*
+ * returns a boolean depending on if a key has a value or not
+ */
+bool ht_has(const HashADT t, const void *key) {
+    return ht_get(t, key) != NULL;
+}
+
+/*
+ * Finds the bucket holding key, or claims one for it (with a NULL value) in
+ * the same probe, growing the table first if needed. *inserted tells which
+ */
+static Bucket *upsertHashed(HashADT t, const void *key, size_t hash, bool *inserted) {
+    if (key == NULL) {
+        fprintf(stderr, "Invalid table or key\n");
+        exit(1);
+    }
+    requireWritable(t);
+    BucketArray *b = &t->buckets;
+    // tombstones lengthen probes just like live entries, so they count towards the load
+    if (t->size + b->tombstones >= b->capacity * maxLoad(t)) {
+        if (loadFactor(t) < maxLoad(t) / 2) {
+            resize(t, b->capacity); // mostly tombstones: compact in place
+        } else {
+            resize(t, b->capacity * RESIZE_FACTOR);
+        }
+    }
+    if (t->old.table != NULL) {
+        migrate(t, HT_MIGRATE_STEP);
+    }
+
+    HT_LOOKUP_BEGIN(t);
+    size_t slot;
+    size_t index = findIndexOrSlot(t, b, key, hash, &slot);
+    if (index == HT_NOT_FOUND && t->old.table != NULL) {
+        // mid-rehash the key may not have moved over yet
+        size_t oldIndex = findIndex(t, &t->old, key, hash);
+        if (oldIndex != HT_NOT_FOUND) {
+            HT_LOOKUP_END(t, true);
+            *inserted = false;
+            return &t->old.table[oldIndex];
+        }
+    }
+    HT_LOOKUP_END(t, index != HT_NOT_FOUND);
+    if (index != HT_NOT_FOUND) {
+        *inserted = false;
+        return &b->table[index];
+    }
+
+    // put pair in table, stored inline with its hash
+    if (t->probe == HT_PROBE_ROBINHOOD) {
+        robinHoodPlace(t, b, slot, key, NULL, hash);
+    } else {
+        placeEntry(t, b, slot, key, NULL, hash);
+    }
+    t->size++;
+    *inserted = true;
+    return &b->table[slot];
+}
+
+/*
+ * Puts a value at a key whose hash is already known
+ */
+static void *putHashed(HashADT t, const void *key, const void *value, size_t hash) {
+    bool inserted;
+    Bucket *bucket = upsertHashed(t, key, hash, &inserted);
+    // no old value for a new key
+    void *old = inserted ? NULL : (void *)bucket->pair.value;
+    bucket->pair.value = value;
+    return old;
+}
+
+/*
+ * Puts a value at a key in the hashtable
+ */
+void *ht_put(HashADT t, const void *key, const void *value) {
+    if (t == NULL || key == NULL) {
+        fprintf(stderr, "Invalid table or key\n");
+        exit(1);
+    }
+    return putHashed(t, key, value, hashKey(t, key));
+}
+
+/*
+ * Returns the value slot for key, inserting key with a NULL value if it is
+ * missing, so a read-modify-write costs one hash and one probe. The slot is
+ * only valid until the table is next modified. With ht_set_incremental on,
+ * lookups migrate buckets too, so any later call on the table, ht_get and
+ * ht_has included, can move the entry and invalidate the slot
+ */
+const void **ht_get_or_insert(HashADT t, const void *key, bool *inserted) {
+    if (t == NULL || key == NULL || inserted == NULL) {
+        fprintf(stderr, "Invalid table or key\n");
+        exit(1);
+    }
+    return &upsertHashed(t, key, hashKey(t, key), inserted)->pair.value;
+}
+
+/*
+ * Replaces the value at key with update(key, current, ctx), where current is
+ * NULL if the key was absent (it is then inserted). Returns the new value
+ */
+const void *ht_update(HashADT t, const void *key,
+                      const void *(*update)(const void *key, const void *value, void *ctx), void *ctx) {
+    if (t == NULL || key == NULL || update == NULL) {
+        fprintf(stderr, "Invalid table, key or update\n");
+        exit(1);
+    }
+    bool inserted;
+    Bucket *bucket = upsertHashed(t, key, hashKey(t, key), &inserted);
+    bucket->pair.value = update(bucket->pair.key, inserted ? NULL : bucket->pair.value, ctx);
+    return bucket->pair.value;
+}
+
+/*
+ * Grows the table to take count more keys, so no resize lands between
+ * prefetching a block and putting it. An incremental table only swaps in the
+ * new array (and not while a migration is still draining), leaving the moves
+ * to later operations as usual
+ */
+static void reserveBlock(HashADT t, size_t count) {
+    size_t capacity = capacityFor(t, t->size + count);
+    if (capacity <= t->buckets.capacity) {
+        return;
+    }
+    if (!t->incremental || t->old.table == NULL) {
+        resize(t, capacity);
+    }
+}
+
+/*
+ * Hashes a block of keys and prefetches each one's home buckets so the cache
+ * misses of the whole block overlap instead of being taken one key at a time
+ */
+static void prefetchBlock(const HashADT t, const void **keys, size_t n, size_t *hashes) {
+    const BucketArray *b = &t->buckets;
+    for (size_t i = 0; i < n; i++) {
+        hashes[i] = hashKey(t, keys[i]);
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (t->snapshot != NULL) {
+            HT_PREFETCH(t->snapshot->buckets + (hashes[i] & (t->snapshot->capacity - 1)));
+        } else if (t->probe == HT_PROBE_SWISS) {
+            size_t group = swissHomeGroup(hashes[i], b->capacity) * HT_GROUP_WIDTH;
+            HT_PREFETCH(b->ctrl + group);
+            HT_PREFETCH(b->table + group);
+        } else {
+            HT_PREFETCH(b->table + (hashes[i] & (b->capacity - 1)));
+        }
+    }
+}
+
+/*
+ * Looks up n keys at once, storing each value (or NULL) in values
+ */
+void ht_get_many(const HashADT t, const void **keys, size_t n, const void **values) {
+    if (t == NULL || keys == NULL || values == NULL) {
+        fprintf(stderr, "Invalid table or batch\n");
+        exit(1);
+    }
+    size_t hashes[HT_BATCH];
+    for (size_t start = 0; start < n; start += HT_BATCH) {
+        size_t count = n - start < HT_BATCH ? n - start : HT_BATCH;
+        prefetchBlock(t, keys + start, count, hashes);
+        for (size_t i = 0; i < count; i++) {
+            if (t->snapshot != NULL) {
+                values[start + i] = snapshotGet(t, keys[start + i], hashes[i]);
+                continue;
+            }
+            BucketArray *owner;
+            Bucket *found = lookup(t, keys[start + i], hashes[i], &owner);
+            values[start + i] = found != NULL ? found->pair.value : NULL;
+        }
+    }
+}
+
+/*
+ * Puts n key/value pairs at once, growing the table ahead of the prefetched blocks.
+ * If old is not NULL it receives the replaced value (or NULL) of each key
+ */
+void ht_put_many(HashADT t, const void **keys, const void **values, size_t n, void **old) {
+    if (t == NULL || keys == NULL || values == NULL) {
+        fprintf(stderr, "Invalid table or batch\n");
+        exit(1);
+    }
+    requireWritable(t);
+    size_t sizeBefore = t->size;
+    size_t hashes[HT_BATCH];
+    for (size_t start = 0; start < n; start += HT_BATCH) {
+        size_t count = n - start < HT_BATCH ? n - start : HT_BATCH;
+        // expect the rest of the batch to add keys at the rate seen so far, so a
+        // fresh load grows once while keys already present don't inflate the table
+        size_t expected = count;
+        if (start != 0) {
+            expected = (size_t)((double)(n - start) * (t->size - sizeBefore) / start);
+            expected = expected > count ? expected : count;
+        }
+        reserveBlock(t, expected);
+        prefetchBlock(t, keys + start, count, hashes);
+        for (size_t i = 0; i < count; i++) {
+            void *replaced = putHashed(t, keys[start + i], values[start + i], hashes[i]);
+            if (old != NULL) {
+                old[start + i] = replaced;
+            }
+        }
+    }
+}
+
+/*
+ * Removes key from the hashtable, handing the stored key and value to the delete
+ * function. Returns false if the key was not present
+ */
+bool ht_remove(HashADT t, const void *key) {
+    if (t == NULL || key == NULL) {
+        fprintf(stderr, "Invalid table or key\n");
+        exit(1);
+    }
+    requireWritable(t);
+    BucketArray *owner;
+    Bucket *found = lookup(t, key, hashKey(t, key), &owner);
+    if (found == NULL) {
+        return false;
+    }
+    KeyValue pair = found->pair;
+    eraseEntry(t, owner, (size_t)(found - owner->table));
+    t->size--;
+    if (t->delete != NULL) {
+        t->delete((void *)pair.key, (void *)pair.value);
+    }
+    return true;
+}
+
+/*
+ * Fills stats from counters the table keeps up to date as it changes, so this
+ * costs the same regardless of table size
+ */
+void ht_stats(const HashADT t, HashStats *stats) {
+    if (t == NULL || stats == NULL) {
+        fprintf(stderr, "Invalid table or stats\n");
+        exit(1);
+    }
+    stats->size = t->size;
+    stats->capacity = t->snapshot != NULL ? t->snapshot->capacity : t->buckets.capacity;
+    stats->tombstones = t->buckets.tombstones;
+    stats->loadFactor = (double)t->size / stats->capacity;
+    stats->rehashes = t->rehashes;
+    stats->resizeNanos = t->resizeNanos;
+    stats->bytesAllocated = t->bytes;
+    stats->maxProbe = t->buckets.maxProbe;
+    for (size_t i = 0; i < HT_PROBE_HISTOGRAM; i++) {
+        stats->probeHistogram[i] = t->buckets.probes[i];
+    }
+    // entries still waiting in the old array of an incremental rehash
+    if (t->old.table != NULL) {
+        stats->tombstones += t->old.tombstones;
+        if (t->old.maxProbe > stats->maxProbe) {
+            stats->maxProbe = t->old.maxProbe;
+        }
+        for (size_t i = 0; i < HT_PROBE_HISTOGRAM; i++) {
+            stats->probeHistogram[i] += t->old.probes[i];
+        }
+    }
+}
+
+/*
+ * Copies out the table's lookup and rehash counters. Returns false (and zeroes
+ * counters) when the library was built without ADTOOL_INSTRUMENT
+ */
+bool ht_counters(const HashADT t, HashCounters *counters) {
+#ifdef ADTOOL_INSTRUMENT
+    *counters = t->counters;
+    return true;
+#else
+    (void)t;
+    *counters = (HashCounters){ 0 };
+    return false;
+#endif
+}
+
+/*
+ * Starts a walk over every entry. The table must not be modified (ht_put,
+ * ht_get or ht_remove, which may migrate buckets) until the walk is finished
+ */
+void ht_iter_begin(const HashADT t, HashIter *it) {
+    if (t == NULL || it == NULL) {
+        fprintf(stderr, "Invalid table or iterator\n");
+        exit(1);
+    }
+    it->table = t;
+    it->array = 0;
+    it->index = 0;
+}
+
+/*
+ * Advances the iterator, yielding the next key and value. Returns false once
+ * every entry has been visited
+ */
+bool ht_iter_next(HashIter *it, const void **key, const void **value) {
+    const HashADT t = it->table;
+    if (t->snapshot != NULL) {
+        const Snapshot *snap = t->snapshot;
+        while (it->index < snap->capacity) {
+            const SnapshotBucket *b = &snap->buckets[it->index++];
+            if (b->keyOffset != 0) {
+                *key = snap->base + b->keyOffset;
+                *value = b->valueOffset != 0 ? snap->base + b->valueOffset : NULL;
+                return true;
+            }
+        }
+        return false;
+    }
+    while (it->array < 2) {
+        const BucketArray *b = it->array == 0 ? &t->buckets : &t->old;
+        while (b->table != NULL && it->index < b->capacity) {
+            size_t i = it->index++;
+            if (isFull(t, b, i)) {
+                *key = b->table[i].pair.key;
+                *value = b->table[i].pair.value;
+                return true;
+            }
+        }
+        // buckets of the old array below the migration point are already moved
+        it->array++;
+        it->index = t->migrated;
+    }
+    return false;
+}
+
+/*
+ * Calls visit on every entry without allocating
+ */
+void ht_foreach(const HashADT t, void (*visit)(const void *key, const void *value, void *ctx), void *ctx) {
+    HashIter it;
+    const void *key;
+    const void *value;
+    ht_iter_begin(t, &it);
+    while (ht_iter_next(&it, &key, &value)) {
+        visit(key, value, ctx);
+    }
+}
+
+/*
+ * Copies the keys (or values) of every entry into out, which holds t->size slots
+ */
+static void collect(const HashADT t, void **out, bool keys) {
+    HashIter it;
+    const void *key;
+    const void *value;
+    size_t outIndex = 0;
+    ht_iter_begin(t, &it);
+    while (ht_iter_next(&it, &key, &value)) {
+        out[outIndex] = keys ? (void *)key : (void *)value;
+        outIndex++;
+    }
+}
+
+/*
+ * Returns array of all the keys
+ */
+void **ht_keys(const HashADT t) {
+    if (t == NULL) {
+        fprintf(stderr, "Invalid table to obtain keys\n");
+    }
+
+    void **keys = (void **)malloc(t->size * sizeof(void *));
+    if (keys == NULL) {
+        fprintf(stderr, "Memory allocation failed while creating keys\n");
+        exit(1);
+    }
+
+    collect(t, keys, true);
+    return keys;
+}
+
+/*
+ * Returns collection of values as array of pointers, allocates space which the caller is responsible
+ * to deallocate
+ */
+void **ht_values(const HashADT t) {
+    if (t == NULL) {
+        fprintf(stderr, "Invalid table to return values\n");
+        exit(1);
+    }
+
+    void **values = (void **)malloc(t->size * sizeof(void *));
+    if (values == NULL) {
+        fprintf(stderr, "Memory allocation error creating values\n");
+        exit(1);
+    }
+
+    collect(t, values, false);
+    return values;
+}
+
+// ||---------------------||
+// || HASH TABLE SNAPSHOTS  ||
+// ||---------------------||
+
+/// Identifies snapshot files, and rejects ones written on a machine of the
+/// other byte order
+#define SNAPSHOT_MAGIC "ADTHTSNP"
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+#define SNAPSHOT_VERSION 2u
+/// Payloads start on 8 byte boundaries so integer keys can be read in place
+#define SNAPSHOT_ALIGN 8
+
+/// First bytes of a snapshot file; the bucket array follows at bucketsOffset,
+/// then the key and value payloads the buckets point at
+typedef struct {
+    char magic[8];
+    uint32_t byteOrder;
+    uint32_t version;
+    uint64_t capacity;
+    uint64_t size;
+    uint64_t bucketsOffset;
+    uint64_t length; // total file size
+} SnapshotHeader;
+
+static uint64_t snapshotAlign(uint64_t offset) {
+    return (offset + SNAPSHOT_ALIGN - 1) & ~(uint64_t)(SNAPSHOT_ALIGN - 1);
+}
+
+/*
+ * Writes bytes of data (through the serializer's write hook) followed by the
+ * zero padding that aligns what comes next. scratch grows as needed
+ */
+static bool writePayload(FILE *file, const void *data, size_t size, void (*write)(const void *data, void *out),
+                         unsigned char **scratch, size_t *scratchSize) {
+    static const unsigned char padding[SNAPSHOT_ALIGN] = {0};
+    if (size > *scratchSize) {
+        unsigned char *grown = (unsigned char *)realloc(*scratch, size);
+        if (grown == NULL) {
+            fprintf(stderr, "Memory allocation failed writing snapshot\n");
+            exit(1);
+        }
+        *scratch = grown;
+        *scratchSize = size;
+    }
+    write(data, *scratch);
+    size_t pad = (size_t)(snapshotAlign(size) - size);
+    return fwrite(*scratch, 1, size, file) == size && fwrite(padding, 1, pad, file) == pad;
+}
+
+/*
+ * Writes every entry to path as a flat, offset-based file that ht_open_mapped
+ * can serve lookups from without rebuilding the table. The first pass lays out
+ * the buckets (linear probing at LOAD_THRESHOLD, whatever t's own engine), the
+ * second streams the payloads in the same order. Returns false if the file
+ * couldn't be written
+ */
+bool ht_save(const HashADT t, const char *path, const HashSerializer *serializer) {
+    if (t == NULL || path == NULL || serializer == NULL) {
+        fprintf(stderr, "Invalid table, path or serializer to save\n");
+        exit(1);
+    }
+    size_t capacity = INITIAL_CAPACITY;
+    while (capacity * LOAD_THRESHOLD < t->size) {
+        capacity *= RESIZE_FACTOR;
+    }
+    SnapshotBucket *buckets = (SnapshotBucket *)calloc(capacity, sizeof(SnapshotBucket));
+    if (buckets == NULL) {
+        fprintf(stderr, "Memory allocation failed creating snapshot buckets\n");
+        exit(1);
+    }
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.byteOrder = SNAPSHOT_BYTE_ORDER;
+    header.version = SNAPSHOT_VERSION;
+    header.capacity = capacity;
+    header.size = t->size;
+    header.bucketsOffset = snapshotAlign(sizeof(SnapshotHeader));
+
+    HashIter it;
+    const void *key;
+    const void *value;
+    uint64_t offset = header.bucketsOffset + (uint64_t)capacity * sizeof(SnapshotBucket);
+    ht_iter_begin(t, &it);
+    while (ht_iter_next(&it, &key, &value)) {
+        uint64_t hash = (uint64_t)hashKey(t, key);
+        size_t index = (size_t)hash & (capacity - 1);
+        while (buckets[index].keyOffset != 0) {
+            index = (index + 1) & (capacity - 1);
+        }
+        buckets[index].hash = hash;
+        buckets[index].keyOffset = offset;
+        buckets[index].keySize = serializer->keySize(key);
+        offset += snapshotAlign(buckets[index].keySize);
+        if (value != NULL) {
+            buckets[index].valueOffset = offset;
+            buckets[index].valueSize = serializer->valueSize(value);
+            offset += snapshotAlign(buckets[index].valueSize);
+        }
+    }
+    header.length = offset;
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Cannot open %s to save the table\n", path);
+        free(buckets);
+        return false;
+    }
+    unsigned char gap[SNAPSHOT_ALIGN] = {0};
+    size_t gapSize = (size_t)(header.bucketsOffset - sizeof(SnapshotHeader));
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+              && fwrite(gap, 1, gapSize, file) == gapSize
+              && fwrite(buckets, sizeof(SnapshotBucket), capacity, file) == capacity;
+    free(buckets);
+
+    unsigned char *scratch = NULL;
+    size_t scratchSize = 0;
+    ht_iter_begin(t, &it);
+    while (ok && ht_iter_next(&it, &key, &value)) {
+        ok = writePayload(file, key, serializer->keySize(key), serializer->writeKey, &scratch, &scratchSize);
+        if (ok && value != NULL) {
+            ok = writePayload(file, value, serializer->valueSize(value), serializer->writeValue,
+                              &scratch, &scratchSize);
+        }
+    }
+    free(scratch);
+    if (fclose(file) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        fprintf(stderr, "Failed writing table snapshot to %s\n", path);
+    }
+    return ok;
+}
+
+/*
+ * Brings a whole snapshot file into memory: mapped read-only and shared where
+ * the platform has mmap, read into a buffer otherwise
+ */
+static bool loadSnapshot(const char *path, Snapshot *snap) {
+#if defined(ADTOOL_HAVE_MMAP)
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+    snap->length = (size_t)st.st_size;
+    void *base = mmap(NULL, snap->length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps the file alive
+    if (base == MAP_FAILED) {
+        return false;
+    }
+    snap->base = (const unsigned char *)base;
+    snap->isMapped = true;
+    return true;
+#else
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+    long size = -1;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        size = ftell(file);
+    }
+    unsigned char *base = size > 0 ? (unsigned char *)malloc((size_t)size) : NULL;
+    bool ok = base != NULL && fseek(file, 0, SEEK_SET) == 0 && fread(base, 1, (size_t)size, file) == (size_t)size;
+    fclose(file);
+    if (!ok) {
+        free(base);
+        return false;
+    }
+    snap->base = base;
+    snap->length = (size_t)size;
+    snap->isMapped = false;
+    return true;
+#endif
+}
+
+/*
+ * Checks that a payload [offset, offset + size) lies in the payload area of
+ * the file and starts aligned
+ */
+static bool payloadInFile(const Snapshot *snap, uint64_t payloads, uint64_t offset, uint64_t size) {
+    return offset >= payloads && offset % SNAPSHOT_ALIGN == 0 && offset <= snap->length
+           && size <= snap->length - offset;
+}
+
+/*
+ * Checks every bucket's key and value against the file's bounds so lookups on a
+ * truncated or corrupt file can't read past it. Built-in key kinds also get
+ * their shape checked, since their equals reads the key without a size
+ */
+static bool validBuckets(const HashADT t, const Snapshot *snap, uint64_t size) {
+    uint64_t payloads = (uint64_t)((const unsigned char *)snap->buckets - snap->base)
+                        + snap->capacity * sizeof(SnapshotBucket);
+    uint64_t entries = 0;
+    for (size_t i = 0; i < snap->capacity; i++) {
+        const SnapshotBucket *b = &snap->buckets[i];
+        if (b->keyOffset == 0) {
+            continue;
+        }
+        entries++;
+        if (!payloadInFile(snap, payloads, b->keyOffset, b->keySize)
+            || (b->valueOffset != 0 && !payloadInFile(snap, payloads, b->valueOffset, b->valueSize))) {
+            return false;
+        }
+        if (t->keys == KEYS_U64 && b->keySize != sizeof(uint64_t)) {
+            return false;
+        }
+        if (t->keys == KEYS_STR && (b->keySize == 0 || snap->base[b->keyOffset + b->keySize - 1] != '\0')) {
+            return false;
+        }
+    }
+    return entries == size;
+}
+
+/*
+ * Opens a snapshot written by ht_save as a read-only table. Lookups probe the
+ * file's bucket array in place and hand out pointers into it, so nothing is
+ * deserialized and processes opening the same file share its page cache.
+ * ht_put, ht_remove and the other modifying calls exit on such a table.
+ * Returns NULL if the file can't be read or isn't a valid snapshot
+ */
+HashADT ht_open_mapped(const char *path,
+                       size_t (*hash)( const void *key),
+                       bool (*equals)(const void *key1, const void *key2),
+                       void (*print) ( const void *key, const void *value)) {
+    if (path == NULL || hash == NULL || equals == NULL) {
+        fprintf(stderr, "Invalid path or callbacks to open a snapshot\n");
+        exit(1);
+    }
+    Snapshot *snap = (Snapshot *)malloc(sizeof(Snapshot));
+    if (snap == NULL) {
+        fprintf(stderr, "Memory allocation failed opening a snapshot\n");
+        exit(1);
+    }
+    if (!loadSnapshot(path, snap)) {
+        fprintf(stderr, "Cannot read snapshot %s\n", path);
+        free(snap);
+        return NULL;
+    }
+    const SnapshotHeader *header = (const SnapshotHeader *)snap->base;
+    bool valid = snap->length >= sizeof(SnapshotHeader)
+                 && memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) == 0
+                 && header->byteOrder == SNAPSHOT_BYTE_ORDER
+                 && header->version == SNAPSHOT_VERSION
+                 && header->length == snap->length
+                 && header->capacity != 0 && (header->capacity & (header->capacity - 1)) == 0
+                 && header->size < header->capacity
+                 && header->bucketsOffset % SNAPSHOT_ALIGN == 0
+                 && header->bucketsOffset <= snap->length
+                 && header->capacity <= (snap->length - header->bucketsOffset) / sizeof(SnapshotBucket);
+    if (!valid) {
+        fprintf(stderr, "%s is not a valid table snapshot\n", path);
+        closeSnapshot(snap);
+        return NULL;
+    }
+    snap->buckets = (const SnapshotBucket *)(snap->base + header->bucketsOffset);
+    snap->capacity = (size_t)header->capacity;
+
+    // a mapped table never uses a bucket array of its own
+    HashADT t = newTable(NULL, HT_PROBE_LINEAR, hash, equals, print, NULL);
+    if (!validBuckets(t, snap, header->size)) {
+        fprintf(stderr, "%s is not a valid table snapshot\n", path);
+        ht_destroy(t);
+        closeSnapshot(snap);
+        return NULL;
+    }
+    t->snapshot = snap;
+    t->size = (size_t)header->size;
+    return t;
+}
+
+// ||---------------------||
+// || CONCURRENT HASH TABLE ||
+// ||---------------------||
+
+/// Bucket states of a concurrent table
+#define CHT_EMPTY 0
+#define CHT_FULL 1
+#define CHT_DELETED 2
+
+/// Every field is atomic so readers racing a writer never hit a data race;
+/// the segment's sequence counter tells them whether what they read is whole
+typedef struct {
+    _Atomic(const void *) key;
+    _Atomic(const void *) value;
+    atomic_size_t hash;
+    atomic_uchar state;
+} CBucket;
+
+/// One segment's bucket array. A replaced array goes on the segment's retired
+/// list, tagged with the epoch it was retired in, and is freed once every reader
+/// has moved past that epoch, since a reader that loaded it before the swap may
+/// still be probing it
+typedef struct CArray {
+    struct CArray *retired;
+    uint64_t retiredAt; // epoch of its replacement, on the retired list only
+    size_t capacity;
+    CBucket buckets[];
+} CArray;
+
+typedef struct {
+    pthread_mutex_t lock; // serialises writers of this segment
+    atomic_size_t seq; // odd while a writer is changing buckets
+    _Atomic(CArray *) array;
+    CArray *retired; // replaced arrays, newest first, waiting for readers to move on. Writers only
+    size_t size;
+    size_t tombstones;
+    char pad[64]; // keeps neighbouring segments off each other's cache lines
+} Segment;
+
+struct chashtab_s {
+    Segment segments[CHT_SEGMENTS];
+    size_t (*hash)(const void *key);
+    bool (*equals)(const void *key1, const void *key2);
+    void (*print)(const void *key, const void *value);
+    void (*delete)(void *key, void *value);
+};
+
+/*
+ * Mixed hash: the top bits pick the segment, the low bits the bucket
+ */
+static inline uint64_t chtMix(const ConcurrentHashADT t, const void *key) {
+    uint64_t h = (uint64_t)t->hash(key) * 0x9E3779B97F4A7C15ull;
+    return h ^ (h >> 29);
+}
+
+static inline Segment *chtSegment(const ConcurrentHashADT t, uint64_t hash) {
+    return &t->segments[hash >> (64 - CHT_SEGMENT_BITS)];
+}
+
+/*
+ * Allocates an empty bucket array for a segment
+ */
+static CArray *chtAllocArray(size_t capacity) {
+    CArray *a = (CArray *)malloc(sizeof(CArray) + capacity * sizeof(CBucket));
+    if (a == NULL) {
+        fprintf(stderr, "Memory allocation failed creating concurrent table's buckets\n");
+        exit(1);
+    }
+    a->retired = NULL;
+    a->capacity = capacity;
+    for (size_t i = 0; i < capacity; i++) {
+        atomic_init(&a->buckets[i].key, NULL);
+        atomic_init(&a->buckets[i].value, NULL);
+        atomic_init(&a->buckets[i].hash, 0);
+        atomic_init(&a->buckets[i].state, CHT_EMPTY);
+    }
+    return a;
+}
+
+/*
+ * Finds key in a bucket array, or HT_NOT_FOUND. Safe to run concurrently with
+ * a writer; the caller validates the result against the sequence counter
+ */
+static size_t chtFind(const ConcurrentHashADT t, const CArray *a, const void *key, size_t hash) {
+    size_t mask = a->capacity - 1;
+    size_t index = hash & mask;
+    for (size_t probes = 0; probes < a->capacity; probes++) {
+        const CBucket *b = &a->buckets[index];
+        unsigned char state = atomic_load_explicit(&b->state, memory_order_relaxed);
+        if (state == CHT_EMPTY) {
+            return HT_NOT_FOUND;
+        }
+        if (state == CHT_FULL && atomic_load_explicit(&b->hash, memory_order_relaxed) == hash) {
+            const void *stored = atomic_load_explicit(&b->key, memory_order_relaxed);
+            if (stored != NULL && t->equals(key, stored)) {
+                return index;
+            }
+        }
+        index = (index + 1) & mask;
+    }
+    return HT_NOT_FOUND;
+}
+
+/*
+ * Stores an entry in the first free bucket of its probe sequence. Returns true
+ * if that bucket was a tombstone. Writers only
+ */
+static bool chtPlace(CArray *a, const void *key, const void *value, size_t hash) {
+    size_t mask = a->capacity - 1;
+    size_t index = hash & mask;
+    while (atomic_load_explicit(&a->buckets[index].state, memory_order_relaxed) == CHT_FULL) {
+        index = (index + 1) & mask;
+    }
+    CBucket *b = &a->buckets[index];
+    bool reused = atomic_load_explicit(&b->state, memory_order_relaxed) == CHT_DELETED;
+    atomic_store_explicit(&b->key, key, memory_order_relaxed);
+    atomic_store_explicit(&b->value, value, memory_order_relaxed);
+    atomic_store_explicit(&b->hash, hash, memory_order_relaxed);
+    atomic_store_explicit(&b->state, CHT_FULL, memory_order_relaxed);
+    return reused;
+}
+
+/*
+ * Opens and closes a segment's write section. Readers that overlap one retry
+ */
+static inline void chtWriteBegin(Segment *s) {
+    size_t seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+    atomic_store_explicit(&s->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void chtWriteEnd(Segment *s) {
+    size_t seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+    atomic_store_explicit(&s->seq, seq + 1, memory_order_release);
+}
+
+/// A reading thread's announced epoch (0 while it is not inside cht_get). Each
+/// record gets cache lines of its own, so readers never write a line another
+/// core reads on every lookup. Records are shared by all tables and reused
+/// after their thread exits
+typedef struct ChtReader {
+    atomic_uint_least64_t epoch;
+    size_t depth; // nested reads, e.g. a hash function that reads another table. Owner only
+    atomic_bool inUse;
+    struct ChtReader *next; // never changes once the record is published
+} ChtReader;
+
+/// Bytes allocated per record: whole cache lines
+#define CHT_READER_BYTES ((sizeof(ChtReader) + QUEUE_CACHE_LINE - 1) / QUEUE_CACHE_LINE * QUEUE_CACHE_LINE)
+
+/// Bumped by writers each time they retire an array; readers only load it
+static atomic_uint_least64_t chtEpoch = 1;
+static _Atomic(ChtReader *) chtReaders = NULL;
+static _Thread_local ChtReader *chtSelf = NULL;
+static pthread_key_t chtExitKey;
+static pthread_once_t chtExitOnce = PTHREAD_ONCE_INIT;
+
+/*
+ * Hands an exiting thread's record back for reuse
+ */
+static void chtReleaseReader(void *record) {
+    atomic_store(&((ChtReader *)record)->inUse, false);
+}
+
+static void chtInitExitKey(void) {
+    pthread_key_create(&chtExitKey, chtReleaseReader);
+}
+
+/*
+ * Finds this thread's record the first time it reads, taking over a free one
+ * or pushing a new one onto the registry
+ */
+static ChtReader *chtRegister(void) {
+    pthread_once(&chtExitOnce, chtInitExitKey);
+    ChtReader *r = atomic_load(&chtReaders);
+    for (; r != NULL; r = r->next) {
+        bool idle = false;
+        if (atomic_compare_exchange_strong(&r->inUse, &idle, true)) {
+            break;
+        }
+    }
+    if (r == NULL) {
+        r = (ChtReader *)aligned_alloc(QUEUE_CACHE_LINE, CHT_READER_BYTES);
+        if (r == NULL) {
+            fprintf(stderr, "Memory allocation failed registering concurrent table reader\n");
+            exit(1);
+        }
+        atomic_init(&r->epoch, 0);
+        r->depth = 0;
+        atomic_init(&r->inUse, true);
+        r->next = atomic_load(&chtReaders);
+        while (!atomic_compare_exchange_weak(&chtReaders, &r->next, r)) {
+        }
+    }
+    pthread_setspecific(chtExitKey, r);
+    chtSelf = r;
+    return r;
+}
+
+/*
+ * Announces a read. The announcement is ordered before the array pointer is
+ * loaded, so a writer that retires an array and then sees this thread idle or
+ * at a later epoch knows it cannot be holding that array
+ */
+static inline ChtReader *chtEnter(void) {
+    ChtReader *self = chtSelf != NULL ? chtSelf : chtRegister();
+    // a nested read is covered by the outer read's older epoch
+    if (self->depth++ == 0) {
+        // a seq_cst exchange rather than store+fence: a locked op on this thread's
+        // own line is cheaper than a full fence
+        atomic_exchange(&self->epoch, atomic_load(&chtEpoch));
+    }
+    return self;
+}
+
+static inline void chtExit(ChtReader *self) {
+    if (--self->depth == 0) {
+        atomic_store_explicit(&self->epoch, 0, memory_order_release);
+    }
+}
+
+/*
+ * Frees the segment's retired arrays that no reader can still hold: those
+ * retired before the oldest epoch a reader is currently in. Only reads the
+ * reader records, and only when something is waiting to be freed.
+ * Called with the segment lock held
+ */
+static void chtReclaim(Segment *s) {
+    if (s->retired == NULL) {
+        return;
+    }
+    uint64_t oldest = UINT64_MAX;
+    for (ChtReader *r = atomic_load(&chtReaders); r != NULL; r = r->next) {
+        uint64_t epoch = atomic_load(&r->epoch);
+        if (epoch != 0 && epoch < oldest) {
+            oldest = epoch;
+        }
+    }
+    // newest first, so everything after the first freeable array is freeable too
+    CArray **link = &s->retired;
+    while (*link != NULL && (*link)->retiredAt >= oldest) {
+        link = &(*link)->retired;
+    }
+    CArray *a = *link;
+    *link = NULL;
+    while (a != NULL) {
+        CArray *next = a->retired;
+        free(a);
+        a = next;
+    }
+}
+
+/*
+ * Rebuilds a same-sized segment without its tombstones, in place inside a write
+ * section. Readers overlapping it retry, so no second array is needed
+ */
+static void chtCompact(Segment *s) {
+    CArray *a = atomic_load_explicit(&s->array, memory_order_relaxed);
+    typedef struct { const void *key; const void *value; size_t hash; } Live;
+    Live *live = (Live *)malloc((s->size != 0 ? s->size : 1) * sizeof(Live));
+    if (live == NULL) {
+        fprintf(stderr, "Memory allocation failed compacting concurrent table's buckets\n");
+        exit(1);
+    }
+    size_t n = 0;
+    chtWriteBegin(s);
+    for (size_t i = 0; i < a->capacity; i++) {
+        CBucket *b = &a->buckets[i];
+        unsigned char state = atomic_load_explicit(&b->state, memory_order_relaxed);
+        if (state == CHT_FULL) {
+            live[n].key = atomic_load_explicit(&b->key, memory_order_relaxed);
+            live[n].value = atomic_load_explicit(&b->value, memory_order_relaxed);
+            live[n].hash = atomic_load_explicit(&b->hash, memory_order_relaxed);
+            n++;
+        }
+        if (state != CHT_EMPTY) {
+            atomic_store_explicit(&b->state, CHT_EMPTY, memory_order_relaxed);
+            atomic_store_explicit(&b->key, NULL, memory_order_relaxed);
+            atomic_store_explicit(&b->value, NULL, memory_order_relaxed);
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        chtPlace(a, live[i].key, live[i].value, live[i].hash);
+    }
+    s->tombstones = 0;
+    chtWriteEnd(s);
+    free(live);
+}
+
+/*
+ * Rebuilds a segment at newCapacity. The new array is filled while readers keep
+ * using the old one; only publishing it happens inside a write section
+ */
+static void chtResize(Segment *s, size_t newCapacity) {
+    CArray *old = atomic_load_explicit(&s->array, memory_order_relaxed);
+    CArray *a = chtAllocArray(newCapacity);
+    for (size_t i = 0; i < old->capacity; i++) {
+        CBucket *b = &old->buckets[i];
+        if (atomic_load_explicit(&b->state, memory_order_relaxed) == CHT_FULL) {
+            chtPlace(a, atomic_load_explicit(&b->key, memory_order_relaxed),
+                     atomic_load_explicit(&b->value, memory_order_relaxed),
+                     atomic_load_explicit(&b->hash, memory_order_relaxed));
+        }
+    }
+    chtWriteBegin(s);
+    atomic_store(&s->array, a);
+    s->tombstones = 0;
+    chtWriteEnd(s);
+    // readers announcing this epoch or an earlier one may have loaded old
+    old->retiredAt = atomic_fetch_add(&chtEpoch, 1);
+    old->retired = s->retired;
+    s->retired = old;
+    chtReclaim(s);
+}
+
+/*
+ * Creates a new ConcurrentHashADT. Callbacks are the same as for ht_create;
+ * hash and equals must be safe to call from several threads at once
+ */
+ConcurrentHashADT cht_create(size_t (*hash)( const void *key),
+                             bool (*equals)(const void *key1, const void *key2),
+                             void (*print) ( const void *key, const void *value),
+                             void (*delete)(void *key, void *value)) {
+    ConcurrentHashADT t = (ConcurrentHashADT)malloc(sizeof(struct chashtab_s));
+    if (t == NULL) {
+        fprintf(stderr, "Memory allocation failed creating the concurrent hashtable");
+        exit(1);
+    }
+    for (size_t i = 0; i < CHT_SEGMENTS; i++) {
+        Segment *s = &t->segments[i];
+        if (pthread_mutex_init(&s->lock, NULL) != 0) {
+            fprintf(stderr, "Failed to initialise concurrent hashtable lock\n");
+            exit(1);
+        }
+        atomic_init(&s->seq, 0);
+        atomic_init(&s->array, chtAllocArray(INITIAL_CAPACITY));
+        s->retired = NULL;
+        s->size = 0;
+        s->tombstones = 0;
+    }
+    t->hash = hash;
+    t->equals = equals;
+    t->print = print;
+    t->delete = delete;
+    return t;
+}
+
+/*
+ * Destroys the table. No other thread may be using it
+ */
+void cht_destroy(ConcurrentHashADT t) {
+    if (t == NULL) {
+        fprintf(stderr, "Invalid table to destroy\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < CHT_SEGMENTS; i++) {
+        Segment *s = &t->segments[i];
+        CArray *a = atomic_load(&s->array);
+        for (size_t j = 0; j < a->capacity; j++) {
+            CBucket *b = &a->buckets[j];
+            if (atomic_load(&b->state) == CHT_FULL && t->delete != NULL) {
+                t->delete((void *)atomic_load(&b->key), (void *)atomic_load(&b->value));
+            }
+        }
+        free(a);
+        while (s->retired != NULL) {
+            CArray *next = s->retired->retired;
+            free(s->retired);
+            s->retired = next;
+        }
+        pthread_mutex_destroy(&s->lock);
+    }
+    free(t);
+}
+
+/*
+ * Gets value with specified key without taking any lock. The read is retried
+ * if a writer changed the segment while it was in progress
+ */
+const void *cht_get(ConcurrentHashADT t, const void *key) {
+    uint64_t hash = chtMix(t, key);
+    Segment *s = chtSegment(t, hash);
+    // keeps whichever array is loaded below from being freed under this read
+    ChtReader *self = chtEnter();
+    for (;;) {
+        size_t seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+        if (seq & 1) {
+            continue; // writer in progress
+        }
+        const CArray *a = atomic_load(&s->array);
+        size_t index = chtFind(t, a, key, (size_t)hash);
+        const void *value = index == HT_NOT_FOUND
+                ? NULL : atomic_load_explicit(&a->buckets[index].value, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&s->seq, memory_order_relaxed) == seq) {
+            chtExit(self);
+            return value;
+        }
+    }
+}
+
+/*
+ * returns a boolean depending on if a key has a value or not
+ */
+bool cht_has(ConcurrentHashADT t, const void *key) {
+    return cht_get(t, key) != NULL;
+}
+
+/*
+ * Puts a value at a key, locking only the key's segment. Returns the old value
+ */
+void *cht_put(ConcurrentHashADT t, const void *key, const void *value) {
+    if (t == NULL || key == NULL) {
+        fprintf(stderr, "Invalid table or key\n");
+        exit(1);
+    }
+    uint64_t hash = chtMix(t, key);
+    Segment *s = chtSegment(t, hash);
+    pthread_mutex_lock(&s->lock);
+
+    CArray *a = atomic_load_explicit(&s->array, memory_order_relaxed);
+    size_t index = chtFind(t, a, key, (size_t)hash);
+    if (index != HT_NOT_FOUND) {
+        void *old = (void *)atomic_load_explicit(&a->buckets[index].value, memory_order_relaxed);
+        chtWriteBegin(s);
+        atomic_store_explicit(&a->buckets[index].value, value, memory_order_relaxed);
+        chtWriteEnd(s);
+        pthread_mutex_unlock(&s->lock);
+        return old;
+    }
+
+    if (s->size + s->tombstones >= a->capacity * LOAD_THRESHOLD) {
+        if (s->size < a->capacity * LOAD_THRESHOLD / 2) {
+            chtCompact(s); // mostly tombstones
+        } else {
+            chtResize(s, a->capacity * RESIZE_FACTOR);
+            a = atomic_load_explicit(&s->array, memory_order_relaxed);
+        }
+    } else {
+        chtReclaim(s); // arrays a busy reader kept alive at the last resize
+    }
+    chtWriteBegin(s);
+    if (chtPlace(a, key, value, (size_t)hash)) {
+        s->tombstones--;
+    }
+    chtWriteEnd(s);
+    s->size++;
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+/*
+ * Removes key, handing the stored key and value to the delete function. Readers
+ * that started before the removal may still be looking at that key or value, so
+ * delete must defer freeing them (or be NULL) while reads can be in flight
+ */
+bool cht_remove(ConcurrentHashADT t, const void *key) {
+    if (t == NULL || key == NULL) {
+        fprintf(stderr, "Invalid table or key\n");
+        exit(1);
+    }
+    uint64_t hash = chtMix(t, key);
+    Segment *s = chtSegment(t, hash);
+    pthread_mutex_lock(&s->lock);
+
+    CArray *a = atomic_load_explicit(&s->array, memory_order_relaxed);
+    size_t index = chtFind(t, a, key, (size_t)hash);
+    if (index == HT_NOT_FOUND) {
+        pthread_mutex_unlock(&s->lock);
+        return false;
+    }
+    CBucket *b = &a->buckets[index];
+    void *oldKey = (void *)atomic_load_explicit(&b->key, memory_order_relaxed);
+    void *oldValue = (void *)atomic_load_explicit(&b->value, memory_order_relaxed);
+    chtWriteBegin(s);
+    atomic_store_explicit(&b->state, CHT_DELETED, memory_order_relaxed);
+    atomic_store_explicit(&b->key, NULL, memory_order_relaxed);
+    atomic_store_explicit(&b->value, NULL, memory_order_relaxed);
+    chtWriteEnd(s);
+    s->size--;
+    s->tombstones++;
+    pthread_mutex_unlock(&s->lock);
+
+    if (t->delete != NULL) {
+        t->delete(oldKey, oldValue);
+    }
+    return true;
+}
+
+/*
+ * Number of entries. Only exact while no writer is running
+ */
+size_t cht_size(ConcurrentHashADT t) {
+    size_t size = 0;
+    for (size_t i = 0; i < CHT_SEGMENTS; i++) {
+        pthread_mutex_lock(&t->segments[i].lock);
+        size += t->segments[i].size;
+        pthread_mutex_unlock(&t->segments[i].lock);
+    }
+    return size;
+}
+
+// ||---------------||
+// ||  Linked List  ||
+// ||---------------||
+
+/*
+ * Initializes linked list
+ */
+void initLinkedList(LinkedList *list) {
+    initLinkedListAlloc(list, NULL);
+}
+
+/*
+ * Initializes linked list whose nodes come from allocator
+ */
+void initLinkedListAlloc(LinkedList *list, const Allocator *allocator) {
+    list->head = list->tail = NULL;
+    list->size = 0;
+    list->pool = NULL;
+    list->allocator = allocator;
+}
+
+/*
+ * Makes the list take its nodes from pool. Only valid while the list is empty
+ */
+void bindLinkedListPool(LinkedList *list, NodePool *pool) {
+    list->pool = pool;
+}
+
+/*
+ * Inserts a node in the linked list
+ */
+void insert(LinkedList *list, void *data) {
+    Node *new = allocNode(list->pool, list->allocator, data);
+    new->next = list->head;
+    list->head = new;
+    if (list->tail == NULL) {
+        list->tail = new;
+    }
+    list->size++;
+}
+
+/*
+ * Appends a node at the end of the linked list in constant time
+ */
+void insertLast(LinkedList *list, void *data) {
+    Node *new = allocNode(list->pool, list->allocator, data);
+    if (list->tail == NULL) {
+        list->head = list->tail = new;
+    } else {
+        list->tail->next = new;
+        list->tail = new;
+    }
+    list->size++;
+}
+
+/*
+ * Checks if the list is empty
+ */
+bool isLinkedListEmpty(LinkedList *list) {
+    return (list->size == 0);
+}
+
+/*
+ * Removes the first node in the list
+ */
+void removeFirstLinkedNode(LinkedList *list) {
+    if (isLinkedListEmpty(list)) {
+        fprintf(stderr, "List is empty. Cannot remove first node.\n");
+        return;
+    }
+    Node *node = list->head;
+    list->head = node->next;
+    if (list->head == NULL) {
+        list->tail = NULL;
+    }
+    releaseNode(list->pool, list->allocator, node);
+    list->size--;
+}
+
+/*
+ * Removes a specific node in the linked list
+ */
+void removeLinkedListNode(LinkedList *list, void *data) {
+    if (isLinkedListEmpty(list)) {
+        fprintf(stderr, "List is empty. Cannot remove specified node.\n");
+        return;
+    }
+    Node *curr = list->head;
+    Node *prev = NULL;
+    // loops until data is found or end of linked list reached
+    while (curr != NULL) {
+        if (curr->data == data) {
+                if (prev == NULL) {
+                    list->head = curr->next;
+                } else {
+                    prev->next = curr->next;
+                }
+                if (list->tail == curr) {
+                    list->tail = prev;
+                }
+                releaseNode(list->pool, list->allocator, curr);
+                list->size--;
+                return;
+        }
+        prev = curr;
+        curr = curr->next;
+    }
+    // no data found
+    fprintf(stderr, "Data does not exist in linked list.\n");
+}
+
+/*
+ * Gets the size of the linked list
  */
 size_t getLinkedListSize(LinkedList *list) {
     return list->size;
 }
 
 /*
- * Frees the dynamically allocated data.
+ * Frees the dynamically allocated data.
+ */
+void freeLinkedList(LinkedList *list) {
+    if (list->pool != NULL && list->head != NULL) {
+        // hand the whole chain back to the pool in one splice
+        releaseNodes(list->pool, list->head, list->tail);
+        list->head = list->tail = NULL;
+        list->size = 0;
+        return;
+    }
+    while (!isLinkedListEmpty(list)) {
+        // remove first node till end, already frees the nodes!!!
+        removeFirstLinkedNode(list);
+    }
+}
+
+// ||-----------------||
+// || INTRUSIVE LIST  ||
+// ||-----------------||
+
+/*
+ * Initializes an empty intrusive list
+ */
+void initIntrusiveList(IntrusiveList *list) {
+    list->sentinel.prev = list->sentinel.next = &list->sentinel;
+    list->size = 0;
+}
+
+bool isIntrusiveListEmpty(IntrusiveList *list) {
+    return (list->size == 0);
+}
+
+/*
+ * Links link in between prev and next
+ */
+static inline void linkBetween(ListLink *link, ListLink *prev, ListLink *next) {
+    link->prev = prev;
+    link->next = next;
+    prev->next = link;
+    next->prev = link;
+}
+
+/*
+ * Adds link at the front of the list. link must not already be in a list
+ */
+void intrusivePushFront(IntrusiveList *list, ListLink *link) {
+    linkBetween(link, &list->sentinel, list->sentinel.next);
+    list->size++;
+}
+
+/*
+ * Adds link at the back of the list. link must not already be in a list
+ */
+void intrusivePushBack(IntrusiveList *list, ListLink *link) {
+    linkBetween(link, list->sentinel.prev, &list->sentinel);
+    list->size++;
+}
+
+/*
+ * Removes link from the list it is in, in constant time
+ */
+void intrusiveUnlink(IntrusiveList *list, ListLink *link) {
+    link->prev->next = link->next;
+    link->next->prev = link->prev;
+    link->prev = link->next = NULL;
+    list->size--;
+}
+
+/*
+ * Moves a link already in the list to the front (a cache "touch")
+ */
+void intrusiveMoveToFront(IntrusiveList *list, ListLink *link) {
+    if (list->sentinel.next == link) {
+        return;
+    }
+    link->prev->next = link->next;
+    link->next->prev = link->prev;
+    linkBetween(link, &list->sentinel, list->sentinel.next);
+}
+
+/*
+ * First link in the list, or NULL if it is empty
+ */
+ListLink *intrusiveFirst(IntrusiveList *list) {
+    return isIntrusiveListEmpty(list) ? NULL : list->sentinel.next;
+}
+
+/*
+ * Last link in the list, or NULL if it is empty
+ */
+ListLink *intrusiveLast(IntrusiveList *list) {
+    return isIntrusiveListEmpty(list) ? NULL : list->sentinel.prev;
+}
+
+/*
+ * Unlinks and returns the first link, or NULL if the list is empty
+ */
+ListLink *intrusivePopFront(IntrusiveList *list) {
+    ListLink *link = intrusiveFirst(list);
+    if (link != NULL) {
+        intrusiveUnlink(list, link);
+    }
+    return link;
+}
+
+/*
+ * Unlinks and returns the last link, or NULL if the list is empty
+ */
+ListLink *intrusivePopBack(IntrusiveList *list) {
+    ListLink *link = intrusiveLast(list);
+    if (link != NULL) {
+        intrusiveUnlink(list, link);
+    }
+    return link;
+}
+
+/*
+ * Moves every link of other onto the back of list in constant time, leaving
+ * other empty
+ */
+void intrusiveSplice(IntrusiveList *list, IntrusiveList *other) {
+    if (isIntrusiveListEmpty(other)) {
+        return;
+    }
+    ListLink *first = other->sentinel.next;
+    ListLink *last = other->sentinel.prev;
+    first->prev = list->sentinel.prev;
+    list->sentinel.prev->next = first;
+    last->next = &list->sentinel;
+    list->sentinel.prev = last;
+    list->size += other->size;
+    initIntrusiveList(other);
+}
+
+size_t getIntrusiveListSize(IntrusiveList *list) {
+    return list->size;
+}
+
+// ||---------------||
+// ||     QUEUE     ||
+// ||---------------||
+
+/*
+ * Power of two number of slots able to hold capacity elements
+ */
+static size_t ringSlots(size_t capacity) {
+    size_t slots = 1;
+    while (slots < capacity) {
+        slots *= 2;
+    }
+    return slots;
+}
+
+/*
+ * Copies n items into ring slots starting at position pos, wrapping at the end
+ */
+static void ringCopyIn(void **ring, size_t mask, size_t pos, void **items, size_t n) {
+    size_t start = pos & mask;
+    size_t first = mask + 1 - start < n ? mask + 1 - start : n;
+    memcpy(ring + start, items, first * sizeof(void *));
+    memcpy(ring, items + first, (n - first) * sizeof(void *));
+}
+
+/*
+ * Copies n ring slots starting at position pos into out, wrapping at the end
+ */
+static void ringCopyOut(void **ring, size_t mask, size_t pos, void **out, size_t n) {
+    size_t start = pos & mask;
+    size_t first = mask + 1 - start < n ? mask + 1 - start : n;
+    memcpy(out, ring + start, first * sizeof(void *));
+    memcpy(out + first, ring, (n - first) * sizeof(void *));
+}
+
+/*
+ * Initializes queue.
+ */
+void initQueue(Queue *queue, size_t capacity) {
+    initQueueAlloc(queue, capacity, NULL);
+}
+
+/*
+ * Initializes queue whose nodes come from allocator
+ */
+void initQueueAlloc(Queue *queue, size_t capacity, const Allocator *allocator) {
+    queue->allocator = allocator;
+    queue->capacity = capacity;
+    queue->size = 0;
+    queue->head = queue->tail = NULL;
+    queue->pool = NULL;
+    queue->ring = NULL;
+    queue->ringHead = 0;
+    queue->ringMask = 0;
+#ifdef ADTOOL_INSTRUMENT
+    queue->counters = (QueueCounters){ 0 };
+#endif
+}
+
+/*
+ * Initializes a queue backed by a contiguous ring buffer instead of nodes. The
+ * buffer is rounded up to a power of two so indices wrap with a mask, while
+ * the queue still holds at most capacity elements
+ */
+void initRingQueue(Queue *queue, size_t capacity) {
+    initQueue(queue, capacity);
+    size_t slots = ringSlots(capacity);
+    queue->ring = (void **)allocWith(queue->allocator, slots * sizeof(void *));
+    if (queue->ring == NULL) {
+        fprintf(stderr, "Memory allocation failed creating ring queue.\n");
+        exit(EXIT_FAILURE);
+    }
+    queue->ringMask = slots - 1;
+}
+
+/*
+ * Makes the queue take its nodes from pool. Only valid while the queue is empty
+ */
+void bindQueuePool(Queue *queue, NodePool *pool) {
+    queue->pool = pool;
+}
+
+/*
+ * Checks if queue is empty (no size)
+ */
+bool isQueueEmpty(Queue *queue) {
+    return (queue->size == 0);
+}
+
+/*
+ * Checks if queue size has reached the specified capacity
+ */
+bool isQueueFull(Queue *queue) {
+    return (queue->size >= queue->capacity);
+}
+
+/*
+ * removes first Node in queue and returns it's data.
+ */
+void *dequeue(Queue *queue) {
+    // queue is empty and cannot dequeue
+    if (queue->size == 0) {
+        ADT_COUNT(queue->counters.emptyEvents);
+        fprintf(stderr, "Cannot dequeue as there are no nodes to dequeue!\n");
+        return NULL;
+    }
+    if (queue->ring != NULL) {
+        void *data = queue->ring[queue->ringHead];
+        queue->ringHead = (queue->ringHead + 1) & queue->ringMask;
+        queue->size--;
+        return data;
+    }
+    // set head to the next one
+    Node *dequeued = queue->head;
+    queue->head = queue->head->next;
+
+    // if the next was NULL, the tail must be NULL i.e. there was only one Node in queue
+    if (queue->head == NULL) {
+        queue->tail = NULL;
+    }
+    queue->size--;
+
+    void *data = dequeued->data; // data to return from dequeued node
+    releaseNode(queue->pool, queue->allocator, dequeued); // free up dequeued Node's memory
+    return data;
+}
+
+void enqueue(Queue *queue, void *data) {
+    // check if enqueuing makes the size larger than capacity
+    if (queue->size >= queue->capacity) {
+        fprintf(stderr, "Queue exceeds capacity. Cannot enqueue.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (queue->size + 1 == queue->capacity) {
+        ADT_COUNT(queue->counters.fullEvents);
+    }
+    if (queue->ring != NULL) {
+        queue->ring[(queue->ringHead + queue->size) & queue->ringMask] = data;
+        queue->size++;
+        return;
+    }
+
+    Node *new = allocNode(queue->pool, queue->allocator, data);
+    // no nodes in queue
+    if (queue->tail == NULL) {
+        queue->head = queue->tail = new;
+    } else {
+        queue->tail->next = new;
+        queue->tail = new;
+    }
+    queue->size++;
+}
+
+/*
+ * Enqueues n items in one operation: a single copy (split at the wrap point)
+ * for a ring queue, or a pre-built chain spliced onto the tail for a linked one
+ */
+void enqueueMany(Queue *queue, void **items, size_t n) {
+    if (n > queue->capacity - queue->size) {
+        fprintf(stderr, "Queue exceeds capacity. Cannot enqueue.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (n == 0) {
+        return;
+    }
+    if (queue->size + n == queue->capacity) {
+        ADT_COUNT(queue->counters.fullEvents);
+    }
+    if (queue->ring != NULL) {
+        ringCopyIn(queue->ring, queue->ringMask, queue->ringHead + queue->size, items, n);
+        queue->size += n;
+        return;
+    }
+
+    Node *first = allocNode(queue->pool, queue->allocator, items[0]);
+    Node *last = first;
+    for (size_t i = 1; i < n; i++) {
+        last->next = allocNode(queue->pool, queue->allocator, items[i]);
+        last = last->next;
+    }
+    if (queue->tail == NULL) {
+        queue->head = first;
+    } else {
+        queue->tail->next = first;
+    }
+    queue->tail = last;
+    queue->size += n;
+}
+
+/*
+ * Dequeues up to max items into out in one operation, returning how many were taken
+ */
+size_t dequeueMany(Queue *queue, void **out, size_t max) {
+    size_t n = queue->size < max ? queue->size : max;
+    if (n == 0) {
+        // max == 0 on a queue with items isn't an empty event
+        if (queue->size == 0) {
+            ADT_COUNT(queue->counters.emptyEvents);
+        }
+        return 0;
+    }
+    if (queue->ring != NULL) {
+        ringCopyOut(queue->ring, queue->ringMask, queue->ringHead, out, n);
+        queue->ringHead = (queue->ringHead + n) & queue->ringMask;
+        queue->size -= n;
+        return n;
+    }
+
+    Node *first = queue->head;
+    Node *last = first;
+    out[0] = first->data;
+    for (size_t i = 1; i < n; i++) {
+        last = last->next;
+        out[i] = last->data;
+    }
+    queue->head = last->next;
+    if (queue->head == NULL) {
+        queue->tail = NULL;
+    }
+    queue->size -= n;
+    // the taken run goes back to the pool as one chain
+    if (queue->pool != NULL) {
+        releaseNodes(queue->pool, first, last);
+    } else {
+        last->next = NULL;
+        while (first != NULL) {
+            Node *next = first->next;
+            releaseNode(NULL, queue->allocator, first);
+            first = next;
+        }
+    }
+    return n;
+}
+
+size_t getQueueSize(Queue *queue) {
+    return queue->size;
+}
+
+/*
+ * Frees the queue's nodes along with the data they hold
+ */
+void freeQueue(Queue *queue) {
+    if (queue->ring != NULL) {
+        for (size_t i = 0; i < queue->size; i++) {
+            free(queue->ring[(queue->ringHead + i) & queue->ringMask]);
+        }
+        releaseWith(queue->allocator, queue->ring, (queue->ringMask + 1) * sizeof(void *));
+        queue->ring = NULL;
+        queue->ringHead = 0;
+    } else if (queue->pool != NULL && queue->head != NULL) {
+        for (Node *node = queue->head; node != NULL; node = node->next) {
+            free(node->data);
+        }
+        // hand the whole chain back to the pool in one splice
+        releaseNodes(queue->pool, queue->head, queue->tail);
+    } else {
+        while (queue->head != NULL) {
+            Node *dequeued = queue->head;
+            queue->head = dequeued->next;
+            free(dequeued->data);
+            releaseNode(NULL, queue->allocator, dequeued);
+        }
+    }
+    queue->head = queue->tail = NULL;
+    queue->size = 0;
+}
+
+/*
+ * Copies out the queue's counters. Returns false (and zeroes counters) when the
+ * library was built without ADTOOL_INSTRUMENT
+ */
+bool queueCounters(const Queue *queue, QueueCounters *counters) {
+#ifdef ADTOOL_INSTRUMENT
+    *counters = queue->counters;
+    return true;
+#else
+    (void)queue;
+    *counters = (QueueCounters){ 0 };
+    return false;
+#endif
+}
+
+// ||----------------||
+// || PRIORITY QUEUE ||
+// ||----------------||
+
+/// Children per heap node
+#define PQ_ARITY 4
+/// End of the free handle list
+#define PQ_NO_HANDLE ((PQHandle)-1)
+
+/*
+ * Resizes the heap and handle table to hold capacity elements
+ */
+static void pqReserve(PriorityQueue *pq, size_t capacity) {
+    HeapEntry *heap = (HeapEntry *)realloc(pq->heap, capacity * sizeof(HeapEntry));
+    size_t *positions = heap != NULL ? (size_t *)realloc(pq->positions, capacity * sizeof(size_t)) : NULL;
+    if (heap == NULL || positions == NULL) {
+        fprintf(stderr, "Reallocation error growing priority queue to (%zu) elements.", capacity);
+        exit(EXIT_FAILURE);
+    }
+    pq->heap = heap;
+    pq->positions = positions;
+    pq->capacity = capacity;
+}
+
+/*
+ * Initializes an empty priority queue with room for capacity elements before it grows
+ */
+void initPriorityQueue(PriorityQueue *pq, size_t capacity, int (*compare)(const void *a, const void *b)) {
+    pq->heap = NULL;
+    pq->positions = NULL;
+    pq->size = 0;
+    pq->handles = 0;
+    pq->freeHandle = PQ_NO_HANDLE;
+    pq->compare = compare;
+    pqReserve(pq, capacity != 0 ? capacity : 16);
+}
+
+/*
+ * Moves entry into heap slot index and records where its handle now lives
+ */
+static inline void pqSet(PriorityQueue *pq, size_t index, HeapEntry entry) {
+    pq->heap[index] = entry;
+    pq->positions[entry.handle] = index;
+}
+
+/*
+ * Moves the entry at index towards the root past every parent it beats
+ */
+static void siftUp(PriorityQueue *pq, size_t index) {
+    HeapEntry entry = pq->heap[index];
+    while (index > 0) {
+        size_t parent = (index - 1) / PQ_ARITY;
+        if (pq->compare(entry.item, pq->heap[parent].item) >= 0) {
+            break;
+        }
+        pqSet(pq, index, pq->heap[parent]);
+        index = parent;
+    }
+    pqSet(pq, index, entry);
+}
+
+/*
+ * Moves the entry at index down while its best child beats it. The four
+ * children sit next to each other, usually on one cache line
+ */
+static void siftDown(PriorityQueue *pq, size_t index) {
+    HeapEntry entry = pq->heap[index];
+    for (;;) {
+        size_t first = index * PQ_ARITY + 1;
+        if (first >= pq->size) {
+            break;
+        }
+        size_t last = first + PQ_ARITY < pq->size ? first + PQ_ARITY : pq->size;
+        size_t best = first;
+        for (size_t child = first + 1; child < last; child++) {
+            if (pq->compare(pq->heap[child].item, pq->heap[best].item) < 0) {
+                best = child;
+            }
+        }
+        if (pq->compare(pq->heap[best].item, entry.item) >= 0) {
+            break;
+        }
+        pqSet(pq, index, pq->heap[best]);
+        index = best;
+    }
+    pqSet(pq, index, entry);
+}
+
+/*
+ * Builds a priority queue holding the elements of arr in O(n) by sifting down
+ * from the last parent. arr is copied, not taken over; element i gets handle i
+ */
+void initPriorityQueueFromArray(PriorityQueue *pq, Array *arr, int (*compare)(const void *a, const void *b)) {
+    initPriorityQueue(pq, arr->size, compare);
+    for (size_t i = 0; i < arr->size; i++) {
+        pqSet(pq, i, (HeapEntry){ arr->array[i], i });
+    }
+    pq->size = arr->size;
+    pq->handles = arr->size;
+    if (pq->size < 2) {
+        return;
+    }
+    for (size_t i = (pq->size - 2) / PQ_ARITY + 1; i-- > 0;) {
+        siftDown(pq, i);
+    }
+}
+
+/*
+ * Adds item in O(log n) and returns its handle
+ */
+PQHandle pqPush(PriorityQueue *pq, void *item) {
+    if (pq->size == pq->capacity) {
+        pqReserve(pq, pq->capacity * 2);
+    }
+    PQHandle handle;
+    if (pq->freeHandle != PQ_NO_HANDLE) {
+        handle = pq->freeHandle;
+        pq->freeHandle = pq->positions[handle];
+    } else {
+        handle = pq->handles++;
+    }
+    pqSet(pq, pq->size, (HeapEntry){ item, handle });
+    pq->size++;
+    siftUp(pq, pq->size - 1);
+    return handle;
+}
+
+/*
+ * Takes the entry at index out of the heap, refilling the hole with the last
+ * entry, and recycles its handle
+ */
+static void *pqTake(PriorityQueue *pq, size_t index) {
+    HeapEntry taken = pq->heap[index];
+    pq->positions[taken.handle] = pq->freeHandle;
+    pq->freeHandle = taken.handle;
+    pq->size--;
+    if (index < pq->size) {
+        HeapEntry moved = pq->heap[pq->size];
+        pqSet(pq, index, moved);
+        // the moved entry may belong above or below its new spot
+        siftUp(pq, index);
+        if (pq->positions[moved.handle] == index) {
+            siftDown(pq, index);
+        }
+    }
+    return taken.item;
+}
+
+/*
+ * Removes and returns the first element, or NULL if the queue is empty
+ */
+void *pqPop(PriorityQueue *pq) {
+    if (pq->size == 0) {
+        fprintf(stderr, "Priority queue is empty. Cannot pop element.\n");
+        return NULL;
+    }
+    return pqTake(pq, 0);
+}
+
+/*
+ * Returns the first element without removing it, or NULL if the queue is empty
+ */
+void *pqPeek(PriorityQueue *pq) {
+    return pq->size != 0 ? pq->heap[0].item : NULL;
+}
+
+/*
+ * Restores heap order after the caller made the item behind handle compare
+ * smaller (e.g. moved a deadline earlier)
+ */
+void pqDecreaseKey(PriorityQueue *pq, PQHandle handle) {
+    siftUp(pq, pq->positions[handle]);
+}
+
+/*
+ * Removes the element behind handle wherever it is (e.g. a cancelled timer)
+ * and returns it
+ */
+void *pqRemove(PriorityQueue *pq, PQHandle handle) {
+    return pqTake(pq, pq->positions[handle]);
+}
+
+bool isPriorityQueueEmpty(PriorityQueue *pq) {
+    return (pq->size == 0);
+}
+
+size_t getPriorityQueueSize(PriorityQueue *pq) {
+    return pq->size;
+}
+
+/*
+ * Frees the heap. The elements themselves are not freed, as with freeArray
+ */
+void freePriorityQueue(PriorityQueue *pq) {
+    free(pq->heap);
+    free(pq->positions);
+    pq->heap = NULL;
+    pq->positions = NULL;
+    pq->size = 0;
+    pq->capacity = 0;
+}
+
+// ||-------------------||
+// || CONCURRENT QUEUES ||
+// ||-------------------||
+
+/*
+ * Initializes a single-producer/single-consumer queue holding at most capacity elements
+ */
+void initSpscQueue(SpscQueue *queue, size_t capacity) {
+    size_t slots = ringSlots(capacity);
+    queue->ring = (void **)malloc(slots * sizeof(void *));
+    if (queue->ring == NULL) {
+        fprintf(stderr, "Memory allocation failed creating SPSC queue.\n");
+        exit(EXIT_FAILURE);
+    }
+    queue->mask = slots - 1;
+    queue->capacity = capacity;
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    queue->cachedHead = 0;
+    queue->cachedTail = 0;
+}
+
+/*
+ * Adds data unless the queue is full. Producer thread only; wait-free
+ */
+bool spscTryEnqueue(SpscQueue *queue, void *data) {
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    if (tail - queue->cachedHead >= queue->capacity) {
+        // only look at the consumer's index when the cached one says full
+        queue->cachedHead = atomic_load_explicit(&queue->head, memory_order_acquire);
+        if (tail - queue->cachedHead >= queue->capacity) {
+            return false;
+        }
+    }
+    queue->ring[tail & queue->mask] = data;
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+/*
+ * Removes the oldest element into out unless the queue is empty. Consumer thread only; wait-free
+ */
+bool spscTryDequeue(SpscQueue *queue, void **out) {
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    if (head == queue->cachedTail) {
+        queue->cachedTail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+        if (head == queue->cachedTail) {
+            return false;
+        }
+    }
+    *out = queue->ring[head & queue->mask];
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return true;
+}
+
+/*
+ * Enqueues as many of the n items as fit, publishing them with one release
+ * store. Returns how many were added. Producer thread only
  */
-void freeLinkedList(LinkedList *list) {
-    while (!isLinkedListEmpty(list)) {
-        // remove first node till end, already frees the nodes!!!
-        removeFirstLinkedNode(list);
+size_t spscTryEnqueueMany(SpscQueue *queue, void **items, size_t n) {
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    if (queue->capacity - (tail - queue->cachedHead) < n) {
+        queue->cachedHead = atomic_load_explicit(&queue->head, memory_order_acquire);
+    }
+    size_t space = queue->capacity - (tail - queue->cachedHead);
+    n = n < space ? n : space;
+    ringCopyIn(queue->ring, queue->mask, tail, items, n);
+    atomic_store_explicit(&queue->tail, tail + n, memory_order_release);
+    return n;
+}
+
+/*
+ * Dequeues up to max items into out with one release store. Returns how many
+ * were taken. Consumer thread only
+ */
+size_t spscTryDequeueMany(SpscQueue *queue, void **out, size_t max) {
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    if (queue->cachedTail - head < max) {
+        queue->cachedTail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    }
+    size_t available = queue->cachedTail - head;
+    size_t n = max < available ? max : available;
+    ringCopyOut(queue->ring, queue->mask, head, out, n);
+    atomic_store_explicit(&queue->head, head + n, memory_order_release);
+    return n;
+}
+
+/*
+ * Number of queued elements; a snapshot while the other side is running
+ */
+size_t getSpscQueueSize(SpscQueue *queue) {
+    size_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    return atomic_load_explicit(&queue->tail, memory_order_acquire) - head;
+}
+
+/*
+ * Frees the queue and the data still in it. Neither thread may be using it
+ */
+void freeSpscQueue(SpscQueue *queue) {
+    void *data;
+    while (spscTryDequeue(queue, &data)) {
+        free(data);
+    }
+    free(queue->ring);
+    queue->ring = NULL;
+}
+
+/*
+ * Initializes a bounded multi-producer/multi-consumer queue. capacity is rounded
+ * up to a power of two (at least 2)
+ */
+void initMpmcQueue(MpmcQueue *queue, size_t capacity) {
+    size_t slots = ringSlots(capacity < 2 ? 2 : capacity);
+    queue->cells = (MpmcCell *)malloc(slots * sizeof(MpmcCell));
+    if (queue->cells == NULL) {
+        fprintf(stderr, "Memory allocation failed creating MPMC queue.\n");
+        exit(EXIT_FAILURE);
+    }
+    // a cell whose sequence equals a position is free for the producer of that position
+    for (size_t i = 0; i < slots; i++) {
+        atomic_init(&queue->cells[i].sequence, i);
+    }
+    queue->mask = slots - 1;
+    atomic_init(&queue->enqueuePos, 0);
+    atomic_init(&queue->dequeuePos, 0);
+}
+
+/*
+ * Adds data unless the queue is full. Lock-free, any number of producers
+ */
+bool mpmcTryEnqueue(MpmcQueue *queue, void *data) {
+    size_t pos = atomic_load_explicit(&queue->enqueuePos, memory_order_relaxed);
+    for (;;) {
+        MpmcCell *cell = &queue->cells[pos & queue->mask];
+        size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->enqueuePos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                cell->data = data;
+                atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false; // the consumer of the previous lap hasn't freed this cell
+        } else {
+            pos = atomic_load_explicit(&queue->enqueuePos, memory_order_relaxed);
+        }
+    }
+}
+
+/*
+ * Removes the oldest element into out unless the queue is empty. Lock-free,
+ * any number of consumers
+ */
+bool mpmcTryDequeue(MpmcQueue *queue, void **out) {
+    size_t pos = atomic_load_explicit(&queue->dequeuePos, memory_order_relaxed);
+    for (;;) {
+        MpmcCell *cell = &queue->cells[pos & queue->mask];
+        size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->dequeuePos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                *out = cell->data;
+                // free the cell for the producer one lap ahead
+                atomic_store_explicit(&cell->sequence, pos + queue->mask + 1, memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false; // nothing published at this position yet
+        } else {
+            pos = atomic_load_explicit(&queue->dequeuePos, memory_order_relaxed);
+        }
+    }
+}
+
+/*
+ * Enqueues a run of up to n items, claiming all their cells with one CAS.
+ * Returns how many were added (0 when full). Lock-free, any number of producers
+ */
+size_t mpmcTryEnqueueMany(MpmcQueue *queue, void **items, size_t n) {
+    size_t pos = atomic_load_explicit(&queue->enqueuePos, memory_order_relaxed);
+    for (;;) {
+        // count how many consecutive cells from pos are free for this lap
+        size_t k = 0;
+        while (k < n && k <= queue->mask) {
+            size_t seq = atomic_load_explicit(&queue->cells[(pos + k) & queue->mask].sequence,
+                                              memory_order_acquire);
+            if (seq != pos + k) {
+                break;
+            }
+            k++;
+        }
+        if (k == 0) {
+            size_t seq = atomic_load_explicit(&queue->cells[pos & queue->mask].sequence, memory_order_acquire);
+            if ((intptr_t)seq - (intptr_t)pos < 0) {
+                return 0; // full
+            }
+            pos = atomic_load_explicit(&queue->enqueuePos, memory_order_relaxed);
+            continue;
+        }
+        if (atomic_compare_exchange_weak_explicit(&queue->enqueuePos, &pos, pos + k,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+            for (size_t i = 0; i < k; i++) {
+                MpmcCell *cell = &queue->cells[(pos + i) & queue->mask];
+                cell->data = items[i];
+                atomic_store_explicit(&cell->sequence, pos + i + 1, memory_order_release);
+            }
+            return k;
+        }
+    }
+}
+
+/*
+ * Dequeues a run of up to max items into out, claiming them with one CAS.
+ * Returns how many were taken (0 when empty). Lock-free, any number of consumers
+ */
+size_t mpmcTryDequeueMany(MpmcQueue *queue, void **out, size_t max) {
+    size_t pos = atomic_load_explicit(&queue->dequeuePos, memory_order_relaxed);
+    for (;;) {
+        // count how many consecutive cells from pos have been published
+        size_t k = 0;
+        while (k < max && k <= queue->mask) {
+            size_t seq = atomic_load_explicit(&queue->cells[(pos + k) & queue->mask].sequence,
+                                              memory_order_acquire);
+            if (seq != pos + k + 1) {
+                break;
+            }
+            k++;
+        }
+        if (k == 0) {
+            size_t seq = atomic_load_explicit(&queue->cells[pos & queue->mask].sequence, memory_order_acquire);
+            if ((intptr_t)seq - (intptr_t)(pos + 1) < 0) {
+                return 0; // empty
+            }
+            pos = atomic_load_explicit(&queue->dequeuePos, memory_order_relaxed);
+            continue;
+        }
+        if (atomic_compare_exchange_weak_explicit(&queue->dequeuePos, &pos, pos + k,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+            for (size_t i = 0; i < k; i++) {
+                MpmcCell *cell = &queue->cells[(pos + i) & queue->mask];
+                out[i] = cell->data;
+                atomic_store_explicit(&cell->sequence, pos + i + queue->mask + 1, memory_order_release);
+            }
+            return k;
+        }
     }
 }
 
+/*
+ * Approximate number of queued elements while producers or consumers are running
+ */
+size_t getMpmcQueueSize(MpmcQueue *queue) {
+    size_t head = atomic_load_explicit(&queue->dequeuePos, memory_order_acquire);
+    size_t tail = atomic_load_explicit(&queue->enqueuePos, memory_order_acquire);
+    return tail > head ? tail - head : 0;
+}
+
+/*
+ * Frees the queue and the data still in it. No thread may be using it
+ */
+void freeMpmcQueue(MpmcQueue *queue) {
+    void *data;
+    while (mpmcTryDequeue(queue, &data)) {
+        free(data);
+    }
+    free(queue->cells);
+    queue->cells = NULL;
+}
+
+/// Condition variables time out against the monotonic clock where the platform
+/// allows it, so wall clock jumps can't stretch or cut short a wait
+#if defined(CLOCK_MONOTONIC) && !defined(__APPLE__)
+#define BQ_CLOCK CLOCK_MONOTONIC
+#endif
+
+/*
+ * Initializes a blocking queue holding at most capacity elements
+ */
+void initBlockingQueue(BlockingQueue *queue, size_t capacity) {
+    initRingQueue(&queue->queue, capacity);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+#if defined(BQ_CLOCK)
+    pthread_condattr_setclock(&attr, BQ_CLOCK);
+#endif
+    if (pthread_mutex_init(&queue->lock, NULL) != 0 ||
+        pthread_cond_init(&queue->notEmpty, &attr) != 0 ||
+        pthread_cond_init(&queue->notFull, &attr) != 0) {
+        fprintf(stderr, "Failed to initialize blocking queue.\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_condattr_destroy(&attr);
+    queue->waitingProducers = 0;
+    queue->waitingConsumers = 0;
+    queue->closed = false;
+}
+
+/*
+ * Absolute deadline timeoutMs from now on the queue's condition clock
+ */
+static struct timespec bqDeadline(long timeoutMs) {
+    struct timespec ts;
+#if defined(BQ_CLOCK)
+    clock_gettime(BQ_CLOCK, &ts);
+#else
+    timespec_get(&ts, TIME_UTC); // the default condition clock is wall time
+#endif
+    ts.tv_sec += timeoutMs / 1000;
+    ts.tv_nsec += (timeoutMs % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return ts;
+}
+
+/*
+ * Sleeps on cond until signalled or the deadline passes (timeoutMs < 0 waits
+ * forever). Returns false on timeout. Called with lock held
+ */
+static bool bqWait(BlockingQueue *queue, pthread_cond_t *cond, long timeoutMs, const struct timespec *deadline) {
+    bool full = cond == &queue->notFull;
+    uint64_t cycles = ADT_CYCLES();
+    bool woken = true;
+    if (timeoutMs < 0) {
+        pthread_cond_wait(cond, &queue->lock);
+    } else {
+        woken = pthread_cond_timedwait(cond, &queue->lock, deadline) == 0;
+    }
+    cycles = ADT_CYCLES() - cycles;
+    if (full) {
+        ADT_COUNT(queue->queue.counters.fullEvents);
+    } else {
+        ADT_COUNT(queue->queue.counters.emptyEvents);
+    }
+    ADT_ADD(queue->queue.counters.waitCycles, cycles);
+    ADT_TRACE(full ? ADT_TRACE_QUEUE_FULL : ADT_TRACE_QUEUE_EMPTY, queue, queue->queue.capacity,
+              queue->queue.capacity, cycles);
+    return woken;
+}
+
+/*
+ * Adds data, sleeping while the queue is full. timeoutMs of 0 never blocks and
+ * a negative timeout waits forever. Returns false if the wait timed out or the
+ * queue was closed, in which case data was not added
+ */
+bool enqueueWait(BlockingQueue *queue, void *data, long timeoutMs) {
+    struct timespec deadline;
+    if (timeoutMs > 0) {
+        deadline = bqDeadline(timeoutMs);
+    }
+    pthread_mutex_lock(&queue->lock);
+    while (!queue->closed && isQueueFull(&queue->queue)) {
+        queue->waitingProducers++;
+        bool woken = timeoutMs != 0 && bqWait(queue, &queue->notFull, timeoutMs, &deadline);
+        queue->waitingProducers--;
+        // a timeout still gets one last look in case space opened up meanwhile
+        if (!woken && !queue->closed && isQueueFull(&queue->queue)) {
+            pthread_mutex_unlock(&queue->lock);
+            return false;
+        }
+    }
+    if (queue->closed) {
+        pthread_mutex_unlock(&queue->lock);
+        return false;
+    }
+    enqueue(&queue->queue, data);
+    bool wake = queue->waitingConsumers > 0;
+    pthread_mutex_unlock(&queue->lock);
+    if (wake) {
+        pthread_cond_signal(&queue->notEmpty);
+    }
+    return true;
+}
+
+/*
+ * Removes the oldest element into out, sleeping while the queue is empty.
+ * Timeouts work as in enqueueWait. Returns false if nothing arrived in time or
+ * the queue is closed and drained
+ */
+bool dequeueWait(BlockingQueue *queue, void **out, long timeoutMs) {
+    struct timespec deadline;
+    if (timeoutMs > 0) {
+        deadline = bqDeadline(timeoutMs);
+    }
+    pthread_mutex_lock(&queue->lock);
+    while (!queue->closed && isQueueEmpty(&queue->queue)) {
+        queue->waitingConsumers++;
+        bool woken = timeoutMs != 0 && bqWait(queue, &queue->notEmpty, timeoutMs, &deadline);
+        queue->waitingConsumers--;
+        // a try that never sleeps still found nothing, like dequeue on an empty queue
+        if (timeoutMs == 0) {
+            ADT_COUNT(queue->queue.counters.emptyEvents);
+        }
+        if (!woken && !queue->closed && isQueueEmpty(&queue->queue)) {
+            pthread_mutex_unlock(&queue->lock);
+            return false;
+        }
+    }
+    // a closed queue still hands out what was already in it
+    if (isQueueEmpty(&queue->queue)) {
+        pthread_mutex_unlock(&queue->lock);
+        return false;
+    }
+    *out = dequeue(&queue->queue);
+    bool wake = queue->waitingProducers > 0;
+    pthread_mutex_unlock(&queue->lock);
+    if (wake) {
+        pthread_cond_signal(&queue->notFull);
+    }
+    return true;
+}
+
+/*
+ * Closes the queue: every waiter wakes, further enqueues fail and dequeues
+ * fail once the remaining elements are drained
+ */
+void closeBlockingQueue(BlockingQueue *queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->closed = true;
+    pthread_mutex_unlock(&queue->lock);
+    pthread_cond_broadcast(&queue->notEmpty);
+    pthread_cond_broadcast(&queue->notFull);
+}
+
+size_t getBlockingQueueSize(BlockingQueue *queue) {
+    pthread_mutex_lock(&queue->lock);
+    size_t size = getQueueSize(&queue->queue);
+    pthread_mutex_unlock(&queue->lock);
+    return size;
+}
+
+/*
+ * Frees the queue and the data still in it. No thread may be using it
+ */
+void freeBlockingQueue(BlockingQueue *queue) {
+    freeQueue(&queue->queue);
+    pthread_cond_destroy(&queue->notEmpty);
+    pthread_cond_destroy(&queue->notFull);
+    pthread_mutex_destroy(&queue->lock);
+}
+
 // ||---------------||
-// ||     QUEUE     ||
+// ||     STACK     ||
 // ||---------------||
 
 /*
- * Initializes queue.
+ * Initializes stack. A capacityHint beyond the inline slots is reserved up
+ * front so a deep traversal doesn't regrow on the way down
  */
-void initQueue(Queue *queue, size_t capacity) {
-    queue = (Queue *)malloc(sizeof(Queue));
-    if (queue == NULL) {
-        fprintf(stderr, "Memory allocation failed creating queue.\n");
+void initStack(Stack *stack, size_t capacityHint) {
+    stack->items = stack->inlineItems;
+    stack->size = 0;
+    stack->capacity = STACK_INLINE_CAPACITY;
+    stackReserve(stack, capacityHint);
+}
+
+/*
+ * Makes room for at least capacity elements, moving off the inline slots the
+ * first time the stack grows past them
+ */
+void stackReserve(Stack *stack, size_t capacity) {
+    if (capacity <= stack->capacity) {
+        return;
+    }
+    void **items;
+    if (stack->items == stack->inlineItems) {
+        items = (void **) malloc(capacity * sizeof(void *));
+        if (items != NULL) {
+            memcpy(items, stack->inlineItems, stack->size * sizeof(void *));
+        }
+    } else {
+        items = (void **) realloc(stack->items, capacity * sizeof(void *));
+    }
+    if (items == NULL) {
+        fprintf(stderr, "Reallocation error growing stack to (%zu) elements.", capacity);
         exit(EXIT_FAILURE);
     }
-    queue->capacity = capacity;
-    queue->head = queue->tail = NULL;
+    stack->items = items;
+    stack->capacity = capacity;
 }
 
 /*
- * Checks if queue is empty (no size)
+ * Pushes data onto the top of the stack, doubling the buffer when full
  */
-bool isQueueEmpty(Queue *queue) {
-    return (queue->size == 0);
+void stackPush(Stack *stack, void *data) {
+    if (stack->size == stack->capacity) {
+        stackReserve(stack, stack->capacity * 2);
+    }
+    stack->items[stack->size++] = data;
 }
 
 /*
- * Checks if queue size is more than specified capacity
+ * Removes and returns the top element, or NULL if the stack is empty
  */
-bool isQueueFull(Queue *queue) {
-    return (queue->size > queue->capacity);
+void *stackPop(Stack *stack) {
+    if (stack->size == 0) {
+        fprintf(stderr, "Stack is empty. Cannot pop element.\n");
+        return NULL;
+    }
+    return stack->items[--stack->size];
 }
 
 /*
- * removes first Node in queue and returns it's data.
+ * Returns the top element without removing it, or NULL if the stack is empty
  */
-void *dequeue(Queue *queue) {
-    // queue is empty and cannot dequeue
-    if (queue->head == NULL) {
-        fprintf(stderr, "Cannot dequeue as there are no nodes to dequeue!\n");
+void *stackPeek(Stack *stack) {
+    if (stack->size == 0) {
+        return NULL;
     }
-    // set head to the next one
-    Node *dequeued = queue->head;
-    queue->head = queue->head->next;
+    return stack->items[stack->size - 1];
+}
 
-    // if the next was NULL, the tail must be NULL i.e. there was only one Node in queue
-    if (queue->head == NULL) {
-        queue->tail = NULL;
+bool isStackEmpty(Stack *stack) {
+    return (stack->size == 0);
+}
+
+size_t getStackSize(Stack *stack) {
+    return stack->size;
+}
+
+/*
+ * Frees the heap buffer, if the stack ever grew one. The elements themselves
+ * are not freed, as with freeArray
+ */
+void freeStack(Stack *stack) {
+    if (stack->items != stack->inlineItems) {
+        free(stack->items);
     }
-    queue->size--;
+    stack->items = stack->inlineItems;
+    stack->size = 0;
+    stack->capacity = STACK_INLINE_CAPACITY;
+}
 
-    void *data = dequeued->data; // data to return from dequeued node
-    free(dequeued); // free up dequeued Node's memory
-    return data;
+// ||---------------||
+// ||   LRU CACHE   ||
+// ||---------------||
+
+/// What an LRUCache's table maps each key to
+typedef struct {
+    ListLink link; // position in the recency order
+    const void *key;
+    const void *value;
+    size_t bytes;
+} LRUEntry;
+
+/*
+ * Initializes an empty cache holding at most maxEntries entries and maxBytes
+ * bytes (as measured by sizeOf); a limit of 0 is no limit
+ */
+void initLRUCache(LRUCache *cache, size_t maxEntries, size_t maxBytes,
+                  size_t (*hash)(const void *key),
+                  bool (*equals)(const void *key1, const void *key2),
+                  size_t (*sizeOf)(const void *key, const void *value),
+                  void (*delete)(void *key, void *value)) {
+    // the table holds no ownership; entries are deleted by the cache itself
+    cache->table = ht_create_alloc(NULL, HT_PROBE_LINEAR, maxEntries, hash, equals, NULL, NULL);
+    initIntrusiveList(&cache->order);
+    cache->maxEntries = maxEntries;
+    cache->maxBytes = maxBytes;
+    cache->bytes = 0;
+    cache->sizeOf = sizeOf;
+    cache->delete = delete;
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->evictions = 0;
 }
 
-void enqueue(Queue *queue, void *data) {
-    // check if enqueuing makes the size larger than capacity
-    if (queue->size >= queue->capacity) {
-        fprintf(stderr, "Queue exceeds capacity. Cannot enqueue.\n");
+/*
+ * Unlinks an entry already dropped from the table and hands its pair to delete
+ */
+static void dropEntry(LRUCache *cache, LRUEntry *entry) {
+    intrusiveUnlink(&cache->order, &entry->link);
+    cache->bytes -= entry->bytes;
+    if (cache->delete != NULL) {
+        cache->delete((void *)entry->key, (void *)entry->value);
+    }
+    free(entry);
+}
+
+/*
+ * Evicts from the cold end until the cache is within budget. The entry just
+ * used is never evicted, even if it alone is over the byte budget
+ */
+static void evictOverBudget(LRUCache *cache) {
+    while (cache->order.size > 1
+           && ((cache->maxEntries != 0 && cache->order.size > cache->maxEntries)
+               || (cache->maxBytes != 0 && cache->bytes > cache->maxBytes))) {
+        LRUEntry *victim = INTRUSIVE_ENTRY(intrusiveLast(&cache->order), LRUEntry, link);
+        ht_remove(cache->table, victim->key);
+        cache->evictions++;
+        dropEntry(cache, victim);
+    }
+}
+
+/*
+ * Returns the value cached for key (marking it most recently used), or NULL on
+ * a miss. The value stays valid until it is evicted or replaced
+ */
+const void *lruGet(LRUCache *cache, const void *key) {
+    LRUEntry *entry = (LRUEntry *)ht_get(cache->table, key);
+    if (entry == NULL) {
+        cache->misses++;
+        return NULL;
+    }
+    cache->hits++;
+    intrusiveMoveToFront(&cache->order, &entry->link);
+    return entry->value;
+}
+
+/*
+ * Caches value at key as the most recently used entry, evicting cold entries
+ * to stay within budget. An existing entry for key is updated in place; delete
+ * then gets whichever of its old key and value pointers were not passed in
+ * again (NULL for the ones that were), so the cache always owns the key
+ * pointer it was last given
+ */
+void lruPut(LRUCache *cache, const void *key, const void *value) {
+    bool inserted;
+    const void **slot = ht_get_or_insert(cache->table, key, &inserted);
+    if (!inserted) {
+        LRUEntry *entry = (LRUEntry *)*slot;
+        const void *oldKey = entry->key != key ? entry->key : NULL;
+        const void *oldValue = entry->value != value ? entry->value : NULL;
+        if (oldKey != NULL) {
+            // the table keeps its first key pointer, so re-insert under the new one
+            ht_remove(cache->table, oldKey);
+            slot = ht_get_or_insert(cache->table, key, &inserted);
+            *slot = entry;
+        }
+        cache->bytes -= entry->bytes;
+        entry->key = key;
+        entry->value = value;
+        entry->bytes = cache->sizeOf != NULL ? cache->sizeOf(key, value) : 0;
+        cache->bytes += entry->bytes;
+        intrusiveMoveToFront(&cache->order, &entry->link);
+        // only now is nothing left that reads the old pointers
+        if (cache->delete != NULL && (oldKey != NULL || oldValue != NULL)) {
+            cache->delete((void *)oldKey, (void *)oldValue);
+        }
+        evictOverBudget(cache);
+        return;
+    }
+    LRUEntry *entry = (LRUEntry *)malloc(sizeof(LRUEntry));
+    if (entry == NULL) {
+        fprintf(stderr, "Memory allocation failed creating cache entry.\n");
         exit(EXIT_FAILURE);
     }
+    entry->key = key;
+    entry->value = value;
+    entry->bytes = cache->sizeOf != NULL ? cache->sizeOf(key, value) : 0;
+    *slot = entry;
+    intrusivePushFront(&cache->order, &entry->link);
+    cache->bytes += entry->bytes;
+    evictOverBudget(cache);
+}
 
-    Node *new = newNode(data);
-    // no nodes in queue
-    if (queue->tail == NULL) {
-        queue->head = queue->tail = new;
+/*
+ * Removes key from the cache, deleting its entry. Returns false if it wasn't cached
+ */
+bool lruRemove(LRUCache *cache, const void *key) {
+    LRUEntry *entry = (LRUEntry *)ht_get(cache->table, key);
+    if (entry == NULL) {
+        return false;
+    }
+    ht_remove(cache->table, entry->key);
+    dropEntry(cache, entry);
+    return true;
+}
+
+size_t getLRUCacheSize(LRUCache *cache) {
+    return cache->order.size;
+}
+
+/*
+ * Deletes every entry and frees the cache's table
+ */
+void freeLRUCache(LRUCache *cache) {
+    ListLink *link;
+    while ((link = intrusivePopFront(&cache->order)) != NULL) {
+        LRUEntry *entry = INTRUSIVE_ENTRY(link, LRUEntry, link);
+        if (cache->delete != NULL) {
+            cache->delete((void *)entry->key, (void *)entry->value);
+        }
+        free(entry);
+    }
+    ht_destroy(cache->table);
+    cache->table = NULL;
+    cache->bytes = 0;
+}
+
+/*
+ * Initializes a cache of shards (rounded up to a power of two) LRUCaches, each
+ * with an equal share of maxEntries and maxBytes
+ */
+void initShardedLRUCache(ShardedLRUCache *cache, size_t shards, size_t maxEntries, size_t maxBytes,
+                         size_t (*hash)(const void *key),
+                         bool (*equals)(const void *key1, const void *key2),
+                         size_t (*sizeOf)(const void *key, const void *value),
+                         void (*delete)(void *key, void *value)) {
+    size_t count = 1;
+    while (count < shards) {
+        count *= 2;
+    }
+    cache->shards = (LRUShard *)malloc(count * sizeof(LRUShard));
+    if (cache->shards == NULL) {
+        fprintf(stderr, "Memory allocation failed creating cache shards.\n");
+        exit(EXIT_FAILURE);
+    }
+    cache->shardMask = count - 1;
+    cache->hash = hash;
+    for (size_t i = 0; i < count; i++) {
+        // round shares up so a small budget still leaves room in every shard
+        size_t entries = maxEntries != 0 ? (maxEntries + count - 1) / count : 0;
+        size_t bytes = maxBytes != 0 ? (maxBytes + count - 1) / count : 0;
+        if (pthread_mutex_init(&cache->shards[i].lock, NULL) != 0) {
+            fprintf(stderr, "Failed to initialize cache shard.\n");
+            exit(EXIT_FAILURE);
+        }
+        initLRUCache(&cache->shards[i].cache, entries, bytes, hash, equals, sizeOf, delete);
+    }
+}
+
+/*
+ * Shard owning key. Uses the top hash bits, which the shard's own table
+ * doesn't use for its bucket index
+ */
+static LRUShard *shardFor(ShardedLRUCache *cache, const void *key) {
+    uint64_t h = (uint64_t)cache->hash(key) * 0x9E3779B97F4A7C15ull;
+    return &cache->shards[(size_t)(h >> 40) & cache->shardMask];
+}
+
+/*
+ * Looks key up and, on a hit, calls visit with the pair while the shard is
+ * still locked, since another thread may evict the value right after.
+ * Returns whether key was cached
+ */
+bool shardedLruGet(ShardedLRUCache *cache, const void *key,
+                   void (*visit)(const void *key, const void *value, void *ctx), void *ctx) {
+    LRUShard *shard = shardFor(cache, key);
+    pthread_mutex_lock(&shard->lock);
+    LRUEntry *entry = (LRUEntry *)ht_get(shard->cache.table, key);
+    if (entry == NULL) {
+        shard->cache.misses++;
     } else {
-        queue->tail->next = new;
-        queue->tail = new;
+        shard->cache.hits++;
+        intrusiveMoveToFront(&shard->cache.order, &entry->link);
+        if (visit != NULL) {
+            visit(entry->key, entry->value, ctx);
+        }
     }
-    queue->size++;
+    pthread_mutex_unlock(&shard->lock);
+    return entry != NULL;
 }
 
-size_t getQueueSize(Queue *queue) {
-    return queue->size;
+void shardedLruPut(ShardedLRUCache *cache, const void *key, const void *value) {
+    LRUShard *shard = shardFor(cache, key);
+    pthread_mutex_lock(&shard->lock);
+    lruPut(&shard->cache, key, value);
+    pthread_mutex_unlock(&shard->lock);
 }
 
-void freeQueue(Queue *queue) {
-    while (!isQueueEmpty(queue)) {
-        Node *dequeued = queue->head;
-        queue->head = dequeued->next;
-        free(dequeued->data);
-        free(dequeued);
-    }
-    free(queue);
-}
\ No newline at end of file
+bool shardedLruRemove(ShardedLRUCache *cache, const void *key) {
+    LRUShard *shard = shardFor(cache, key);
+    pthread_mutex_lock(&shard->lock);
+    bool removed = lruRemove(&shard->cache, key);
+    pthread_mutex_unlock(&shard->lock);
+    return removed;
+}
+
+/*
+ * Total entries over all shards. Each shard is read under its lock, but the
+ * total is not a single snapshot while other threads are writing
+ */
+size_t getShardedLRUCacheSize(ShardedLRUCache *cache) {
+    size_t size = 0;
+    for (size_t i = 0; i <= cache->shardMask; i++) {
+        pthread_mutex_lock(&cache->shards[i].lock);
+        size += getLRUCacheSize(&cache->shards[i].cache);
+        pthread_mutex_unlock(&cache->shards[i].lock);
+    }
+    return size;
+}
+
+/*
+ * Sums the hit, miss and eviction counters of every shard (any may be NULL)
+ */
+void shardedLruCounters(ShardedLRUCache *cache, uint64_t *hits, uint64_t *misses, uint64_t *evictions) {
+    uint64_t h = 0, m = 0, e = 0;
+    for (size_t i = 0; i <= cache->shardMask; i++) {
+        pthread_mutex_lock(&cache->shards[i].lock);
+        h += cache->shards[i].cache.hits;
+        m += cache->shards[i].cache.misses;
+        e += cache->shards[i].cache.evictions;
+        pthread_mutex_unlock(&cache->shards[i].lock);
+    }
+    if (hits != NULL) {
+        *hits = h;
+    }
+    if (misses != NULL) {
+        *misses = m;
+    }
+    if (evictions != NULL) {
+        *evictions = e;
+    }
+}
+
+/*
+ * Deletes every entry of every shard. No thread may be using the cache
+ */
+void freeShardedLRUCache(ShardedLRUCache *cache) {
+    for (size_t i = 0; i <= cache->shardMask; i++) {
+        freeLRUCache(&cache->shards[i].cache);
+        pthread_mutex_destroy(&cache->shards[i].lock);
+    }
+    free(cache->shards);
+    cache->shards = NULL;
+}
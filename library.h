@@ -4,6 +4,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
 
 // ||---------------||
@@ -16,6 +21,104 @@ typedef struct Node {
 // helper to create new nodes (used for more than linked list)
 Node *newNode(void *data);
 
+/// Nodes allocated per chunk by a NodePool unless told otherwise
+#define NODE_POOL_CHUNK 256
+
+/// Slab allocator for Nodes: nodes come from chunks of chunkSize and are recycled
+/// through a free list. A pool can back several lists and queues, but is not
+/// thread safe, so everything bound to one pool must stay on one thread
+typedef struct NodePool {
+    Node *free;
+    struct NodeChunk *chunks;
+    size_t chunkSize;
+} NodePool;
+
+void initNodePool(NodePool *pool, size_t chunkSize);
+Node *poolNode(NodePool *pool, void *data);
+void releaseNodes(NodePool *pool, Node *first, Node *last);
+void freeNodePool(NodePool *pool);
+
+/// Memory source for the ADTs. Every hook gets ctx back; reallocate and release
+/// are also told the block's current size so arenas and size-class allocators
+/// need no headers. allocate/reallocate return NULL on failure
+typedef struct Allocator {
+    void *(*allocate)(void *ctx, size_t size);
+    void *(*reallocate)(void *ctx, void *ptr, size_t oldSize, size_t newSize);
+    void (*release)(void *ctx, void *ptr, size_t size);
+    void *ctx;
+} Allocator;
+
+/// malloc/realloc/free; what a NULL allocator means everywhere
+extern const Allocator defaultAllocator;
+
+/// Bytes an Arena takes from its parent at a time unless told otherwise
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+/// Bump-pointer arena. Allocation is a pointer increment, individual releases
+/// are no-ops (except for the most recent block) and freeArena returns
+/// everything at once. Pass &arena.allocator to any ADT constructor. Not thread safe
+typedef struct Arena {
+    Allocator allocator; // hooks bound to this arena
+    struct ArenaBlock *blocks; // newest first
+    size_t blockSize;
+    const Allocator *parent; // where blocks come from, NULL for malloc
+} Arena;
+
+void initArena(Arena *arena, size_t blockSize, const Allocator *parent);
+void *arenaAlloc(Arena *arena, size_t size);
+void arenaReset(Arena *arena);
+void freeArena(Arena *arena);
+
+// ||-----------------||
+// || INSTRUMENTATION ||
+// ||-----------------||
+/// Counters, cycle timing and trace hooks are only compiled in when the library
+/// is built with ADTOOL_INSTRUMENT (the CMake option of the same name), which
+/// also adds a counters field to Array and Queue. Code that includes this
+/// header must see the same setting the library was built with. Without it the
+/// *Counters functions return false and nothing on the hot paths changes
+
+/// Expensive events passed to the trace hook
+typedef enum {
+    ADT_TRACE_REHASH, // a hash table moved to a new bucket array
+    ADT_TRACE_ARRAY_REALLOC, // a dynamic array's storage was reallocated
+    ADT_TRACE_QUEUE_FULL, // a blocking queue producer slept on a full queue
+    ADT_TRACE_QUEUE_EMPTY // a blocking queue consumer slept on an empty queue
+} AdtTraceEvent;
+
+typedef struct {
+    AdtTraceEvent event;
+    const void *source; // the HashADT, Array or BlockingQueue
+    size_t oldCapacity;
+    size_t newCapacity;
+    uint64_t cycles; // how long the event took (rdtsc or an equivalent tick counter)
+} AdtTrace;
+
+/// Called synchronously on the thread that caused the event, so it must be cheap
+/// and must not touch the structure that reported it
+typedef void (*AdtTraceHook)(const AdtTrace *trace, void *ctx);
+
+typedef struct {
+    uint64_t reallocs; // grows and shrinks of the backing store
+    uint64_t reallocCycles;
+} ArrayCounters;
+
+typedef struct {
+    uint64_t fullEvents; // enqueues that filled the queue, and producers that slept on it
+    uint64_t emptyEvents; // dequeues that found nothing, and consumers that slept on it
+    uint64_t waitCycles; // time blocking queue callers spent asleep
+} QueueCounters;
+
+typedef struct {
+    uint64_t lookups; // ht_get/ht_has/ht_remove and the probe of every put
+    uint64_t misses;
+    uint64_t probes; // buckets (groups for swiss tables) examined by those lookups
+    uint64_t longestProbe; // most probes any single lookup needed
+    uint64_t rehashCycles; // time spent in resize and incremental migration
+} HashCounters;
+
+void adtSetTraceHook(AdtTraceHook hook, void *ctx);
+
 // ||---------------||
 // || DYNAMIC ARRAY ||
 // ||---------------||
@@ -23,12 +126,111 @@ typedef struct {
     void **array;
     size_t size;
     size_t capacity;
+    const Allocator *allocator; // NULL: storage comes from malloc
+#ifdef ADTOOL_INSTRUMENT
+    ArrayCounters counters;
+#endif
 } Array;
 
 void initArray(Array *arr, size_t init_capacity);
+void initArrayAlloc(Array *arr, size_t init_capacity, const Allocator *allocator);
 void insertArrayElement(Array *arr, void *element, size_t index);
+void arrayPush(Array *arr, void *element);
+void *arrayPop(Array *arr);
+void *arrayRemoveAt(Array *arr, size_t index);
+void *arraySwapRemove(Array *arr, size_t index);
+void arrayReserve(Array *arr, size_t capacity);
+void arrayShrinkToFit(Array *arr);
+void arrayAppendMany(Array *arr, void **elements, size_t n);
 void *getArrayElement(Array *arr, size_t index);
 void freeArray(Array *arr);
+bool arrayCounters(const Array *arr, ArrayCounters *counters);
+
+/// Arrays at least this long are sorted, mapped and reduced on several threads
+#define ARRAY_PARALLEL_THRESHOLD (1 << 16)
+/// Upper bound on worker threads used by the parallel array algorithms
+#define ARRAY_MAX_THREADS 64
+
+void arraySort(Array *arr, int (*compare)(const void *a, const void *b));
+void arrayParallelSort(Array *arr, int (*compare)(const void *a, const void *b));
+bool arrayBinarySearch(Array *arr, const void *key, int (*compare)(const void *key, const void *element),
+                       size_t *index);
+void arrayMap(Array *arr, void *(*map)(void *element, void *ctx), void *ctx);
+void *arrayReduce(Array *arr, void *init, void *(*reduce)(void *acc, void *element, void *ctx), void *ctx);
+
+/// Generates Array_T, an array storing elements of type T contiguously by value,
+/// with the same operations as Array suffixed by _T (initArray_T, insertArrayElement_T,
+/// getArrayElement_T, arrayPush_T, arrayPop_T, freeArray_T). T must be a single
+/// identifier, so typedef pointer or struct types first. Use once per type per file
+#define DECLARE_ARRAY(T)                                                                        \
+typedef struct {                                                                                \
+    T *array;                                                                                   \
+    size_t size;                                                                                \
+    size_t capacity;                                                                            \
+} Array_##T;                                                                                    \
+                                                                                                \
+static inline void initArray_##T(Array_##T *arr, size_t init_capacity) {                      \
+    arr->array = init_capacity != 0 ? (T *)malloc(init_capacity * sizeof(T)) : NULL;            \
+    if (init_capacity != 0 && arr->array == NULL) {                                             \
+        fprintf(stderr, "Memory allocation failed creating " #T " array of (%zu) elements.", init_capacity); \
+        exit(EXIT_FAILURE);                                                                     \
+    }                                                                                           \
+    arr->size = 0;                                                                              \
+    arr->capacity = init_capacity;                                                              \
+}                                                                                               \
+                                                                                                \
+static inline void arrayGrow_##T(Array_##T *arr, size_t needed) {                              \
+    if (needed <= arr->capacity) {                                                              \
+        return;                                                                                 \
+    }                                                                                           \
+    size_t capacity = arr->capacity * 2 < needed ? needed : arr->capacity * 2;                  \
+    T *array = (T *)realloc(arr->array, capacity * sizeof(T));                                  \
+    if (array == NULL) {                                                                        \
+        fprintf(stderr, "Reallocation error growing " #T " array to (%zu) elements.", capacity); \
+        exit(EXIT_FAILURE);                                                                     \
+    }                                                                                           \
+    arr->array = array;                                                                         \
+    arr->capacity = capacity;                                                                   \
+}                                                                                               \
+                                                                                                \
+static inline void insertArrayElement_##T(Array_##T *arr, T element, size_t index) {           \
+    if (index > arr->size) {                                                                    \
+        fprintf(stderr, "Index (%zu) out of bounds for array size (%zu)", index, arr->size);    \
+        exit(EXIT_FAILURE);                                                                     \
+    }                                                                                           \
+    arrayGrow_##T(arr, arr->size + 1);                                                          \
+    memmove(arr->array + index + 1, arr->array + index, (arr->size - index) * sizeof(T));       \
+    arr->array[index] = element;                                                                \
+    arr->size++;                                                                                \
+}                                                                                               \
+                                                                                                \
+static inline T getArrayElement_##T(Array_##T *arr, size_t index) {                            \
+    if (index >= arr->size) {                                                                   \
+        fprintf(stderr, "Index (%zu) out of bounds for array size (%zu)", index, arr->size);    \
+        exit(EXIT_FAILURE);                                                                     \
+    }                                                                                           \
+    return arr->array[index];                                                                   \
+}                                                                                               \
+                                                                                                \
+static inline void arrayPush_##T(Array_##T *arr, T element) {                                  \
+    arrayGrow_##T(arr, arr->size + 1);                                                          \
+    arr->array[arr->size++] = element;                                                          \
+}                                                                                               \
+                                                                                                \
+static inline T arrayPop_##T(Array_##T *arr) {                                                 \
+    if (arr->size == 0) {                                                                       \
+        fprintf(stderr, "Array is empty. Cannot pop element.\n");                               \
+        exit(EXIT_FAILURE);                                                                     \
+    }                                                                                           \
+    return arr->array[--arr->size];                                                             \
+}                                                                                               \
+                                                                                                \
+static inline void freeArray_##T(Array_##T *arr) {                                             \
+    free(arr->array);                                                                           \
+    arr->array = NULL;                                                                          \
+    arr->size = 0;                                                                              \
+    arr->capacity = 0;                                                                          \
+}
 
 // ||---------------||
 // ||   HASH TABLE  ||
@@ -37,21 +239,80 @@ void freeArray(Array *arr);
 #define INITIAL_CAPACITY 16
 /// The load at which the table will rehash
 #define LOAD_THRESHOLD 0.75
+/// Robin Hood tables keep probes short enough to run fuller before rehashing
+#define HT_ROBINHOOD_LOAD_THRESHOLD 0.9
 /// The table size will double upon each rehash
 #define RESIZE_FACTOR 2
+/// Number of control bytes a swiss table compares per probe step
+#define HT_GROUP_WIDTH 16
+/// Old buckets moved per operation while an incremental rehash is in flight
+#define HT_MIGRATE_STEP 8
+/// Keys hashed and prefetched together by ht_get_many/ht_put_many
+#define HT_BATCH 16
+/// Probe distances counted individually by ht_stats; longer ones share the last slot
+#define HT_PROBE_HISTOGRAM 16
+
+/// Probing engine behind a HashADT
+typedef enum {
+    /// slot-at-a-time linear probing over the bucket array
+    HT_PROBE_LINEAR,
+    /// swiss table: 1-byte control tags matched 16 buckets at a time (SSE2/NEON)
+    HT_PROBE_SWISS,
+    /// linear probing where inserts displace entries closer to home, so probe
+    /// lengths stay even, misses stop early and deletes shift back (no tombstones)
+    HT_PROBE_ROBINHOOD
+} HashProbe;
+
+/// Built-in hashes. Tables built with ht_hash_str/ht_equals_str or
+/// ht_hash_u64/ht_equals_u64 (including through ht_create_str/ht_create_u64)
+/// call them inline rather than through the function pointers
+uint64_t ht_hash_bytes( const void *data, size_t length, uint64_t seed );
+size_t ht_hash_str( const void *key ); // NUL-terminated string keys
+bool ht_equals_str( const void *key1, const void *key2 );
+size_t ht_hash_u64( const void *key ); // keys point at a uint64_t
+bool ht_equals_u64( const void *key1, const void *key2 );
+size_t ht_hash_ptr( const void *key ); // the key's address itself is the key
 
 typedef struct {
     const void *key;
     const void *value;
 } KeyValue;
 
+/// Buckets hold the pair inline along with the key's cached hash, so probing
+/// the table never has to follow a pointer out of the bucket array
 typedef struct {
-    KeyValue *pair;
+    KeyValue pair;
+    size_t hash;
     bool isOccupied;
+    /// tombstone left by ht_remove, dropped on the next resize
+    bool isDeleted;
 } Bucket;
 
 typedef struct hashtab_s *HashADT;
 
+/// Snapshot of a table's health, see ht_stats
+typedef struct {
+    size_t size;
+    size_t capacity;
+    size_t tombstones;
+    double loadFactor;
+    size_t rehashes;
+    /// entries by distance from their home bucket (probe steps between groups for swiss)
+    size_t probeHistogram[HT_PROBE_HISTOGRAM];
+    /// longest distance of any entry placed since the last rehash
+    size_t maxProbe;
+    /// total time spent in resize() and incremental migration
+    uint64_t resizeNanos;
+    size_t bytesAllocated;
+} HashStats;
+
+/// Cursor for walking a table without allocating; see ht_iter_begin
+typedef struct {
+    struct hashtab_s *table;
+    int array;
+    size_t index;
+} HashIter;
+
 HashADT ht_create(
         size_t (*hash)( const void *key ),
         bool (*equals)( const void *key1, const void *key2 ),
@@ -59,31 +320,166 @@ HashADT ht_create(
         void (*delete)( void *key, void *value )
 );
 
+HashADT ht_create_probe(
+        HashProbe probe,
+        size_t (*hash)( const void *key ),
+        bool (*equals)( const void *key1, const void *key2 ),
+        void (*print)( const void *key, const void *value ),
+        void (*delete)( void *key, void *value )
+);
+
+HashADT ht_create_sized(
+        size_t capacity,
+        size_t (*hash)( const void *key ),
+        bool (*equals)( const void *key1, const void *key2 ),
+        void (*print)( const void *key, const void *value ),
+        void (*delete)( void *key, void *value )
+);
+
+/// General constructor: the other ht_create variants forward here. A NULL
+/// allocator means malloc; capacity 0 means INITIAL_CAPACITY
+HashADT ht_create_alloc(
+        const Allocator *allocator,
+        HashProbe probe,
+        size_t capacity,
+        size_t (*hash)( const void *key ),
+        bool (*equals)( const void *key1, const void *key2 ),
+        void (*print)( const void *key, const void *value ),
+        void (*delete)( void *key, void *value )
+);
+
+HashADT ht_create_str(
+        void (*print)( const void *key, const void *value ),
+        void (*delete)( void *key, void *value )
+);
+
+HashADT ht_create_u64(
+        void (*print)( const void *key, const void *value ),
+        void (*delete)( void *key, void *value )
+);
+
+void ht_reserve( HashADT t, size_t n );
+void ht_set_incremental( HashADT t, bool incremental );
 void ht_destroy( HashADT t );
 void ht_dump( const HashADT t, bool contents );
 const void *ht_get( const HashADT t, const void *key );
 bool ht_has( const HashADT t, const void *key );
 void *ht_put( HashADT t, const void *key, const void *value );
+bool ht_remove( HashADT t, const void *key );
+const void **ht_get_or_insert( HashADT t, const void *key, bool *inserted );
+const void *ht_update( HashADT t, const void *key,
+                       const void *(*update)( const void *key, const void *value, void *ctx ), void *ctx );
+void ht_get_many( const HashADT t, const void **keys, size_t n, const void **values );
+void ht_put_many( HashADT t, const void **keys, const void **values, size_t n, void **old );
+void ht_stats( const HashADT t, HashStats *stats );
+bool ht_counters( const HashADT t, HashCounters *counters );
+void ht_iter_begin( const HashADT t, HashIter *it );
+bool ht_iter_next( HashIter *it, const void **key, const void **value );
+void ht_foreach( const HashADT t, void (*visit)( const void *key, const void *value, void *ctx ), void *ctx );
 void **ht_keys( const HashADT t );
 void **ht_values( const HashADT t );
+
+/// Turns keys and values into the bytes of a snapshot. Whatever write produces
+/// is what a mapped table later hands to equals and print, so for strings it is
+/// the characters plus the terminator, for plain structs their bytes
+typedef struct {
+    size_t (*keySize)( const void *key );
+    void (*writeKey)( const void *key, void *out );
+    size_t (*valueSize)( const void *value );
+    void (*writeValue)( const void *value, void *out );
+} HashSerializer;
+
+bool ht_save( const HashADT t, const char *path, const HashSerializer *serializer );
+
+/// Opens an ht_save snapshot read-only. hash must give the same values as the
+/// one the snapshot was saved with (so it can't hash pointer addresses).
+/// Returns NULL if the file, or any key or value it points at, is malformed
+HashADT ht_open_mapped(
+        const char *path,
+        size_t (*hash)( const void *key ),
+        bool (*equals)( const void *key1, const void *key2 ),
+        void (*print)( const void *key, const void *value )
+);
 static double loadFactor(HashADT t);
 
+// ||---------------------||
+// || CONCURRENT HASH TABLE ||
+// ||---------------------||
+/// Log2 of the number of independently locked segments
+#define CHT_SEGMENT_BITS 6
+/// Writers lock one of this many segments; readers take no lock at all
+#define CHT_SEGMENTS (1 << CHT_SEGMENT_BITS)
+
+typedef struct chashtab_s *ConcurrentHashADT;
+
+ConcurrentHashADT cht_create(
+        size_t (*hash)( const void *key ),
+        bool (*equals)( const void *key1, const void *key2 ),
+        void (*print)( const void *key, const void *value ),
+        void (*delete)( void *key, void *value )
+);
+
+void cht_destroy( ConcurrentHashADT t );
+const void *cht_get( ConcurrentHashADT t, const void *key );
+bool cht_has( ConcurrentHashADT t, const void *key );
+void *cht_put( ConcurrentHashADT t, const void *key, const void *value );
+bool cht_remove( ConcurrentHashADT t, const void *key );
+size_t cht_size( ConcurrentHashADT t );
+
 // ||---------------||
 // ||  Linked List  ||
 // ||---------------||
 typedef struct {
     Node *head;
+    Node *tail;
     size_t size;
+    NodePool *pool; // NULL: nodes come from allocator
+    const Allocator *allocator; // NULL: nodes come from malloc
 } LinkedList;
 
 void initLinkedList(LinkedList *list);
+void initLinkedListAlloc(LinkedList *list, const Allocator *allocator);
+void bindLinkedListPool(LinkedList *list, NodePool *pool);
 void insert(LinkedList *list, void *data);
+void insertLast(LinkedList *list, void *data);
 bool isLinkedListEmpty(LinkedList *list);
 void removeLinkedListNode(LinkedList *list, void *data);
 void removeFirstLinkedNode(LinkedList *list);
 size_t getLinkedListSize(LinkedList *list);
 void freeLinkedList(LinkedList *list);
 
+// ||-----------------||
+// || INTRUSIVE LIST  ||
+// ||-----------------||
+/// Link embedded in the user's own struct, so list operations never allocate.
+/// An element can sit in several lists at once through separate links
+typedef struct ListLink {
+    struct ListLink *prev;
+    struct ListLink *next;
+} ListLink;
+
+/// Circular doubly linked list around a sentinel link
+typedef struct {
+    ListLink sentinel;
+    size_t size;
+} IntrusiveList;
+
+/// Recovers the struct of the given type that embeds link as member
+#define INTRUSIVE_ENTRY(link, type, member) ((type *)((char *)(link) - offsetof(type, member)))
+
+void initIntrusiveList(IntrusiveList *list);
+bool isIntrusiveListEmpty(IntrusiveList *list);
+void intrusivePushFront(IntrusiveList *list, ListLink *link);
+void intrusivePushBack(IntrusiveList *list, ListLink *link);
+void intrusiveUnlink(IntrusiveList *list, ListLink *link);
+void intrusiveMoveToFront(IntrusiveList *list, ListLink *link);
+ListLink *intrusiveFirst(IntrusiveList *list);
+ListLink *intrusiveLast(IntrusiveList *list);
+ListLink *intrusivePopFront(IntrusiveList *list);
+ListLink *intrusivePopBack(IntrusiveList *list);
+void intrusiveSplice(IntrusiveList *list, IntrusiveList *other);
+size_t getIntrusiveListSize(IntrusiveList *list);
+
 
 // ||---------------||
 // ||     QUEUE     ||
@@ -95,19 +491,218 @@ typedef struct {
     struct Node *tail;
     size_t size;
     size_t capacity;
+    NodePool *pool; // NULL: nodes come from allocator
+    const Allocator *allocator; // NULL: nodes and ring come from malloc
+    // ring buffer mode (see initRingQueue), ring is NULL for a linked queue
+    void **ring;
+    size_t ringHead;
+    size_t ringMask;
+#ifdef ADTOOL_INSTRUMENT
+    QueueCounters counters;
+#endif
 } Queue;
 
 void initQueue(Queue *queue, size_t capacity);
+void initQueueAlloc(Queue *queue, size_t capacity, const Allocator *allocator);
+void initRingQueue(Queue *queue, size_t capacity);
+void bindQueuePool(Queue *queue, NodePool *pool);
 bool isQueueEmpty(Queue *queue);
 bool isQueueFull(Queue *queue);
 void *dequeue(Queue *queue);
 void enqueue(Queue *queue, void *data);
+void enqueueMany(Queue *queue, void **items, size_t n);
+size_t dequeueMany(Queue *queue, void **out, size_t max);
 size_t getQueueSize(Queue *queue);
 void freeQueue(Queue *queue);
+bool queueCounters(const Queue *queue, QueueCounters *counters);
+
+// ||----------------||
+// || PRIORITY QUEUE ||
+// ||----------------||
+/// Identifies an element of a PriorityQueue for pqDecreaseKey/pqRemove. Valid
+/// from the push that returned it until that element is popped or removed
+typedef size_t PQHandle;
+
+typedef struct {
+    void *item;
+    PQHandle handle;
+} HeapEntry;
+
+/// Min-heap ordered by compare (negative: a comes out first), stored as a
+/// 4-ary heap in one array so a sift touches few cache lines
+typedef struct {
+    HeapEntry *heap;
+    size_t size;
+    size_t capacity;
+    size_t *positions; // heap index of each live handle, next free handle for free ones
+    size_t handles; // handles ever handed out
+    PQHandle freeHandle; // head of the free handle list
+    int (*compare)(const void *a, const void *b);
+} PriorityQueue;
+
+void initPriorityQueue(PriorityQueue *pq, size_t capacity, int (*compare)(const void *a, const void *b));
+void initPriorityQueueFromArray(PriorityQueue *pq, Array *arr, int (*compare)(const void *a, const void *b));
+PQHandle pqPush(PriorityQueue *pq, void *item);
+void *pqPop(PriorityQueue *pq);
+void *pqPeek(PriorityQueue *pq);
+void pqDecreaseKey(PriorityQueue *pq, PQHandle handle);
+void *pqRemove(PriorityQueue *pq, PQHandle handle);
+bool isPriorityQueueEmpty(PriorityQueue *pq);
+size_t getPriorityQueueSize(PriorityQueue *pq);
+void freePriorityQueue(PriorityQueue *pq);
+
+// ||-------------------||
+// || CONCURRENT QUEUES ||
+// ||-------------------||
+/// Padding that keeps fields written by different threads on separate cache lines
+#define QUEUE_CACHE_LINE 64
+
+/// Wait-free ring queue for exactly one producer and one consumer thread
+typedef struct {
+    atomic_size_t head; // next position to dequeue, written by the consumer
+    size_t cachedTail; // consumer's last view of tail
+    char padHead[QUEUE_CACHE_LINE];
+    atomic_size_t tail; // next position to enqueue, written by the producer
+    size_t cachedHead; // producer's last view of head
+    char padTail[QUEUE_CACHE_LINE];
+    void **ring;
+    size_t mask;
+    size_t capacity;
+} SpscQueue;
+
+void initSpscQueue(SpscQueue *queue, size_t capacity);
+bool spscTryEnqueue(SpscQueue *queue, void *data);
+bool spscTryDequeue(SpscQueue *queue, void **out);
+size_t spscTryEnqueueMany(SpscQueue *queue, void **items, size_t n);
+size_t spscTryDequeueMany(SpscQueue *queue, void **out, size_t max);
+size_t getSpscQueueSize(SpscQueue *queue);
+void freeSpscQueue(SpscQueue *queue);
+
+typedef struct {
+    atomic_size_t sequence;
+    void *data;
+} MpmcCell;
+
+/// Bounded lock-free queue for any number of producers and consumers, using
+/// per-cell sequence counters (Vyukov)
+typedef struct {
+    MpmcCell *cells;
+    size_t mask;
+    char padCells[QUEUE_CACHE_LINE];
+    atomic_size_t enqueuePos;
+    char padEnqueue[QUEUE_CACHE_LINE];
+    atomic_size_t dequeuePos;
+    char padDequeue[QUEUE_CACHE_LINE];
+} MpmcQueue;
+
+void initMpmcQueue(MpmcQueue *queue, size_t capacity);
+bool mpmcTryEnqueue(MpmcQueue *queue, void *data);
+bool mpmcTryDequeue(MpmcQueue *queue, void **out);
+size_t mpmcTryEnqueueMany(MpmcQueue *queue, void **items, size_t n);
+size_t mpmcTryDequeueMany(MpmcQueue *queue, void **out, size_t max);
+size_t getMpmcQueueSize(MpmcQueue *queue);
+void freeMpmcQueue(MpmcQueue *queue);
+
+/// Bounded queue whose producers sleep while it is full and whose consumers
+/// sleep while it is empty, instead of exiting or returning NULL
+typedef struct {
+    Queue queue; // ring mode, only touched with lock held
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+    size_t waitingProducers;
+    size_t waitingConsumers;
+    bool closed;
+} BlockingQueue;
+
+void initBlockingQueue(BlockingQueue *queue, size_t capacity);
+bool enqueueWait(BlockingQueue *queue, void *data, long timeoutMs);
+bool dequeueWait(BlockingQueue *queue, void **out, long timeoutMs);
+void closeBlockingQueue(BlockingQueue *queue);
+size_t getBlockingQueueSize(BlockingQueue *queue);
+void freeBlockingQueue(BlockingQueue *queue);
 
 // ||---------------||
 // ||     STACK     ||
 // ||---------------||
+/// Elements a Stack holds inline before it first touches the heap
+#define STACK_INLINE_CAPACITY 16
+
+/// LIFO stack over a contiguous buffer. Shallow stacks live entirely in the
+/// inline slots, so a Stack must not be copied or moved once initialized
+typedef struct {
+    void **items; // inlineItems until the stack outgrows them
+    size_t size;
+    size_t capacity;
+    void *inlineItems[STACK_INLINE_CAPACITY];
+} Stack;
+
+void initStack(Stack *stack, size_t capacityHint);
+void stackReserve(Stack *stack, size_t capacity);
+void stackPush(Stack *stack, void *data);
+void *stackPop(Stack *stack);
+void *stackPeek(Stack *stack);
+bool isStackEmpty(Stack *stack);
+size_t getStackSize(Stack *stack);
+void freeStack(Stack *stack);
+
+// ||---------------||
+// ||   LRU CACHE   ||
+// ||---------------||
+/// Bounded cache evicting the least recently used entry. A HashADT maps keys
+/// to entries threaded on an IntrusiveList in recency order, so get, put and
+/// evict are all O(1). Not thread safe; see ShardedLRUCache
+typedef struct {
+    HashADT table; // key -> private entry
+    IntrusiveList order; // most recently used first
+    size_t maxEntries; // 0: no entry limit
+    size_t maxBytes; // 0: no byte limit
+    size_t bytes; // sum of sizeOf over the entries
+    size_t (*sizeOf)(const void *key, const void *value); // NULL: entries cost no bytes
+    void (*delete)(void *key, void *value); // called for evicted, replaced and removed entries; see lruPut
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+} LRUCache;
+
+void initLRUCache(LRUCache *cache, size_t maxEntries, size_t maxBytes,
+                  size_t (*hash)(const void *key),
+                  bool (*equals)(const void *key1, const void *key2),
+                  size_t (*sizeOf)(const void *key, const void *value),
+                  void (*delete)(void *key, void *value));
+const void *lruGet(LRUCache *cache, const void *key);
+void lruPut(LRUCache *cache, const void *key, const void *value);
+bool lruRemove(LRUCache *cache, const void *key);
+size_t getLRUCacheSize(LRUCache *cache);
+void freeLRUCache(LRUCache *cache);
+
+/// One lock-protected LRUCache of a ShardedLRUCache, padded to its own cache line
+typedef struct {
+    pthread_mutex_t lock;
+    LRUCache cache;
+    char pad[QUEUE_CACHE_LINE];
+} LRUShard;
+
+/// Thread-safe LRU cache: keys are spread over independently locked shards,
+/// each holding an equal part of the budget
+typedef struct {
+    LRUShard *shards;
+    size_t shardMask; // shard count - 1, a power of two
+    size_t (*hash)(const void *key);
+} ShardedLRUCache;
+
+void initShardedLRUCache(ShardedLRUCache *cache, size_t shards, size_t maxEntries, size_t maxBytes,
+                         size_t (*hash)(const void *key),
+                         bool (*equals)(const void *key1, const void *key2),
+                         size_t (*sizeOf)(const void *key, const void *value),
+                         void (*delete)(void *key, void *value));
+bool shardedLruGet(ShardedLRUCache *cache, const void *key,
+                   void (*visit)(const void *key, const void *value, void *ctx), void *ctx);
+void shardedLruPut(ShardedLRUCache *cache, const void *key, const void *value);
+bool shardedLruRemove(ShardedLRUCache *cache, const void *key);
+size_t getShardedLRUCacheSize(ShardedLRUCache *cache);
+void shardedLruCounters(ShardedLRUCache *cache, uint64_t *hits, uint64_t *misses, uint64_t *evictions);
+void freeShardedLRUCache(ShardedLRUCache *cache);
 
 
 #endif //ADTOOL_LIBRARY_H